@@ -0,0 +1,204 @@
+#include "Autotune.hpp"
+
+#include "Fluid.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <csignal>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+
+#include <poll.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+double Divergence::max() const {
+    return std::max({p_error, center_error, frame_diff});
+}
+
+Divergence divergence(const FluidSnapshot& reference, const FluidSnapshot& snapshot) {
+    if (reference.n != snapshot.n || reference.m != snapshot.m) {
+        throw std::runtime_error("snapshots of different size");
+    }
+
+    Divergence ans;
+
+    double dp2 = 0, p2 = 0;
+    size_t diff_cells = 0;
+    for (size_t i = 0; i < reference.p.size(); ++i) {
+        double dp = snapshot.p[i] - reference.p[i];
+        dp2 += dp * dp;
+        p2 += reference.p[i] * reference.p[i];
+        if (snapshot.field[i] != reference.field[i]) {
+            ++diff_cells;
+        }
+    }
+    // Absolute error, if the reference has no pressure at all
+    ans.p_error = p2 > 0 ? std::sqrt(dp2 / p2) : std::sqrt(dp2 / reference.p.size());
+    ans.frame_diff = reference.p.empty() ? 0 : (double) diff_cells / reference.p.size();
+
+    for (size_t c = 0; c < reference.center.size(); ++c) {
+        double dc = std::abs(snapshot.center[c] - reference.center[c]);
+        ans.center_error = std::max(ans.center_error, reference.n > 0 ? dc / reference.n : dc);
+    }
+
+    return ans;
+}
+
+std::optional<AutotuneMeasure> run_isolated(
+    const std::function<AutotuneMeasure()>& f,
+    std::chrono::duration<double> timeout
+) {
+    static_assert(std::is_trivially_copyable_v<AutotuneMeasure>);
+
+    int fds[2];
+    if (pipe(fds) != 0) {
+        throw std::runtime_error("failed to create pipe");
+    }
+    // Otherwise buffered output is printed by both processes
+    std::cout.flush();
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        close(fds[0]);
+        close(fds[1]);
+        throw std::runtime_error("failed to fork");
+    }
+    if (pid == 0) {
+        close(fds[0]);
+        int code = 1;
+        try {
+            AutotuneMeasure measure = f();
+            if (write(fds[1], &measure, sizeof(measure)) == sizeof(measure)) {
+                code = 0;
+            }
+        } catch (const std::exception& e) {
+            std::cerr << e.what() << std::endl;
+        }
+        std::cout.flush();
+        _exit(code);
+    }
+
+    close(fds[1]);
+    AutotuneMeasure measure;
+    ssize_t bytes = -1;
+    pollfd pfd{.fd = fds[0], .events = POLLIN};
+    if (poll(&pfd, 1, std::chrono::duration_cast<std::chrono::milliseconds>(timeout).count()) > 0) {
+        bytes = read(fds[0], &measure, sizeof(measure));
+    } else {
+        kill(pid, SIGKILL);
+    }
+    close(fds[0]);
+
+    int status = 0;
+    waitpid(pid, &status, 0);
+    if (bytes != sizeof(measure) || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        return std::nullopt;
+    }
+    return measure;
+}
+
+void print_autotune(const std::vector<AutotuneResult>& results, size_t ticks_count, double error_bound) {
+    std::cout
+        << "\nAutotune, " << ticks_count << " ticks, error bound " << error_bound << ":\n"
+        << std::left
+        << std::setw(22) << "p-type"
+        << std::setw(22) << "v-type"
+        << std::setw(22) << "v-flow-type"
+        << std::setw(12) << "ticks/s"
+        << std::setw(12) << "p error"
+        << std::setw(14) << "center error"
+        << "frame diff\n";
+
+    const AutotuneResult* best = nullptr;
+    for (const auto& result : results) {
+        std::cout
+            << std::setw(22) << result.p_type
+            << std::setw(22) << result.v_type
+            << std::setw(22) << result.v_flow_type;
+        if (!result.measure) {
+            std::cout << "failed\n";
+            continue;
+        }
+
+        const auto& measure = *result.measure;
+        bool fits = measure.divergence.max() <= error_bound;
+        if (fits && (best == nullptr || measure.ticks_per_second > best->measure->ticks_per_second)) {
+            best = &result;
+        }
+        std::cout
+            << std::setw(12) << std::setprecision(4) << measure.ticks_per_second
+            << std::setw(12) << std::setprecision(3) << measure.divergence.p_error
+            << std::setw(14) << measure.divergence.center_error
+            << measure.divergence.frame_diff
+            << (fits ? "" : " (over bound)") << "\n"
+            << std::setprecision(6);
+    }
+    std::cout << std::right;
+
+    if (best == nullptr) {
+        std::cout << "\nNo triple within the error bound" << std::endl;
+        return;
+    }
+    std::cout
+        << "\nFastest within the bound: "
+        << "--p-type=" << best->p_type << " "
+        << "--v-type=" << best->v_type << " "
+        << "--v-flow-type=" << best->v_flow_type << std::endl;
+}
+
+FluidSnapshot run_prefix(Simulation& simulation, size_t ticks_count, double* ticks_per_second) {
+    auto start_time = std::chrono::steady_clock::now();
+    simulation.step(ticks_count);
+    auto end_time = std::chrono::steady_clock::now();
+
+    if (ticks_per_second != nullptr) {
+        std::chrono::duration<double> duration = end_time - start_time;
+        *ticks_per_second = ticks_count / duration.count();
+    }
+    return simulation.snapshot();
+}
+
+Autotuner::Autotuner(std::string scenario, const FluidOptions& options, size_t ticks_count)
+  : scenario(std::move(scenario)),
+    options(options),
+    ticks_count(ticks_count)
+{
+    // The reference does not depend on TYPES, so it is built directly
+    std::stringstream ss(this->scenario);
+    Fluid<double, double, double> fluid(ss, options);
+
+    auto start_time = std::chrono::steady_clock::now();
+    fluid.run(ticks_count, true);
+    auto end_time = std::chrono::steady_clock::now();
+    reference = fluid.snapshot();
+
+    std::chrono::duration<double> duration = end_time - start_time;
+    double ticks_per_second = ticks_count / duration.count();
+    timeout = std::chrono::duration<double>(1 + TIMEOUT_FACTOR * ticks_count / ticks_per_second);
+}
+
+void Autotuner::run(const SimulationTypes& types) {
+    results.push_back(AutotuneResult{
+        .p_type = types.p_type,
+        .v_type = types.v_type,
+        .v_flow_type = types.v_flow_type,
+        .measure = run_isolated([&] {
+            AutotuneMeasure measure;
+            auto simulation = Simulation::create(scenario, types, options);
+            auto snapshot = run_prefix(*simulation, ticks_count, &measure.ticks_per_second);
+            measure.divergence = divergence(reference, snapshot);
+            return measure;
+        }, timeout),
+    });
+}
+
+void Autotuner::run_all() {
+    for (const auto& types : Simulation::compiled_types()) {
+        run(types);
+    }
+}
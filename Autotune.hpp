@@ -0,0 +1,80 @@
+#pragma once
+
+#include "FluidOptions.hpp"
+#include "FluidSnapshot.hpp"
+#include "Simulation.hpp"
+
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <optional>
+#include <string>
+#include <vector>
+
+/// Divergence of a run from the reference run
+struct Divergence {
+    /// RMS of p - p_ref, relative to RMS of p_ref
+    double p_error = 0;
+    /// Max over materials of |center - center_ref|, relative to the height of
+    /// the field
+    double center_error = 0;
+    /// Share of cells, that hold another material than in the reference
+    double frame_diff = 0;
+
+    /// Single error value, that is checked against the bound
+    double max() const;
+};
+
+Divergence divergence(const FluidSnapshot& reference, const FluidSnapshot& snapshot);
+
+/// What is measured for a single triple
+struct AutotuneMeasure {
+    double ticks_per_second = 0;
+    Divergence divergence;
+};
+
+struct AutotuneResult {
+    std::string p_type;
+    std::string v_type;
+    std::string v_flow_type;
+    /// Empty, if the run has crashed
+    std::optional<AutotuneMeasure> measure;
+};
+
+/// Runs f in a child process, so that a triple, that crashes (e.g. fails an
+/// assertion due to lack of precision) or never finishes (e.g. flow, that is
+/// coarser than velocity, may not converge), does not stop autotuning.
+/// Returns nullopt, if the child has failed or has been killed after the
+/// timeout. No threads may be running at the call.
+std::optional<AutotuneMeasure> run_isolated(
+    const std::function<AutotuneMeasure()>& f,
+    std::chrono::duration<double> timeout
+);
+
+/// Prints all results and the fastest triple within the error bound
+void print_autotune(const std::vector<AutotuneResult>& results, size_t ticks_count, double error_bound);
+
+/// Runs a prefix of the scenario, returns the final state. If
+/// ticks_per_second is not null, the speed of the run is written there.
+FluidSnapshot run_prefix(Simulation& simulation, size_t ticks_count, double* ticks_per_second = nullptr);
+
+/// Runs each compiled triple of types for a prefix of the scenario and
+/// compares it with the reference run in double. All runs use the seed from
+/// options, so that they see the same random numbers.
+struct Autotuner {
+    std::string scenario;
+    FluidOptions options;
+    size_t ticks_count;
+
+    FluidSnapshot reference;
+    /// Triples, that are that much slower than the reference, are killed
+    std::chrono::duration<double> timeout;
+    std::vector<AutotuneResult> results;
+
+    static constexpr double TIMEOUT_FACTOR = 20;
+
+    Autotuner(std::string scenario, const FluidOptions& options, size_t ticks_count);
+
+    void run(const SimulationTypes& types);
+    void run_all();
+};
@@ -0,0 +1,49 @@
+#pragma once
+
+#include "const.hpp"
+
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+
+#ifdef COMPACT_STATE
+    using cell_info_t = uint8_t;
+#else
+    using cell_info_t = int;
+#endif
+
+/// Constant per-cell topology, packed into a single integer:
+///     bits 0..2 -- number of non-wall neighbours (dirs)
+///     bit  3    -- the cell itself is a wall
+///     bits 4..7 -- mask of non-wall neighbours, bit (4 + i) is for deltas[i]
+struct CellInfo {
+    static_assert(deltas.size() <= 4);
+
+    static constexpr cell_info_t DIRS_MASK = 0b111;
+    static constexpr cell_info_t WALL_BIT = 1 << 3;
+    static constexpr size_t OPEN_SHIFT = 4;
+
+    cell_info_t bits;
+
+    static constexpr CellInfo wall() {
+        return CellInfo{WALL_BIT};
+    }
+
+    static constexpr CellInfo from_open_mask(unsigned open_mask) {
+        return CellInfo{(cell_info_t) ((open_mask << OPEN_SHIFT) | std::popcount(open_mask))};
+    }
+
+    constexpr bool is_wall() const {
+        return bits & WALL_BIT;
+    }
+
+    /// Number of non-wall neighbours
+    constexpr int dirs() const {
+        return bits & DIRS_MASK;
+    }
+
+    /// Checks if the neighbour in direction deltas[i] is not a wall
+    constexpr bool is_open(size_t i) const {
+        return (bits >> (OPEN_SHIFT + i)) & 1;
+    }
+};
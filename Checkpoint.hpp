@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+/// Header of the file of Storage::FILE. The rest of the file are the
+/// matrices, in the order they are allocated by Fluid::create_matrices, so
+/// the file is both the storage of a running simulation and its checkpoint.
+struct CheckpointHeader {
+    static constexpr char MAGIC[8] = {'F', 'L', 'U', 'I', 'D', 'C', 'K', '2'};
+    static constexpr size_t TYPE_NAME_SIZE = 128;
+    static constexpr size_t VALUE_SIZE = 16;
+    static constexpr size_t RND_STATE_SIZE = 8192;
+
+    char magic[8];
+    /// Matrices match the rest of the header. Is cleared at the start of
+    /// each tick and set by Fluid::checkpoint, so a file, that is left in
+    /// the middle of a tick, is not resumed.
+    uint8_t complete;
+    /// p is in the second of the two slices of the double buffer, see
+    /// Fluid::apply_p_forces
+    uint8_t p_second;
+
+    uint64_t n, m;
+    uint64_t ticks_done;
+    uint64_t ut;
+
+    /// C++ names of the types, that the matrices are stored in
+    char p_type[TYPE_NAME_SIZE];
+    char v_type[TYPE_NAME_SIZE];
+    char v_flow_type[TYPE_NAME_SIZE];
+
+    /// Raw bytes of rho and g
+    unsigned char rho[256 * VALUE_SIZE];
+    unsigned char g[VALUE_SIZE];
+
+    /// Text of Rnd::state, zero-terminated
+    char rnd_state[RND_STATE_SIZE];
+};
+
+/// Selects the constructor of Fluid, that resumes from a checkpoint
+struct ResumeTag {};
@@ -0,0 +1,112 @@
+#include "Commands.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+
+namespace {
+    /// Reads the separating space and the character after it
+    char read_char(std::istream& in) {
+        if (in.get() != ' ') {
+            throw std::runtime_error("character expected after a space");
+        }
+        int c = in.get();
+        if (c == std::istream::traits_type::eof()) {
+            throw std::runtime_error("character expected after a space");
+        }
+        return c;
+    }
+
+    void expect_end(std::istream& in) {
+        std::string rest;
+        if (in >> rest) {
+            throw std::runtime_error("unexpected '" + rest + "'");
+        }
+    }
+}
+
+void apply_command(Simulation& simulation, std::string_view command) {
+    std::istringstream in{std::string(command)};
+    std::string name;
+    in >> name;
+
+    if (name == "fill") {
+        size_t x0, y0, x1, y1;
+        if (!(in >> x0 >> y0 >> x1 >> y1)) {
+            throw std::runtime_error("fill expects x0 y0 x1 y1 c");
+        }
+        char c = read_char(in);
+        expect_end(in);
+        if (x0 > x1 || y0 > y1) {
+            throw std::runtime_error("corners of fill should be ordered");
+        }
+        simulation.fill(x0, y0, x1 + 1, y1 + 1, c);
+    } else if (name == "g") {
+        double value;
+        if (!(in >> value)) {
+            throw std::runtime_error("g expects a value");
+        }
+        expect_end(in);
+        simulation.set_g(value);
+    } else if (name == "rho") {
+        char c = read_char(in);
+        double value;
+        if (!(in >> value)) {
+            throw std::runtime_error("rho expects c value");
+        }
+        expect_end(in);
+        simulation.set_rho(c, value);
+    } else {
+        throw std::runtime_error("unknown command '" + name + "'");
+    }
+}
+
+CommandChannel::CommandChannel(const std::string& path)
+  : fd(0),
+    own_fd(path != "-")
+{
+    if (own_fd) {
+        // Opening a FIFO would wait for a writer otherwise
+        fd = open(path.c_str(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+        if (fd < 0) {
+            throw std::runtime_error("failed to open commands: " + std::string(std::strerror(errno)));
+        }
+    }
+}
+
+CommandChannel::~CommandChannel() {
+    if (own_fd) {
+        close(fd);
+    }
+}
+
+std::vector<std::string> CommandChannel::poll() {
+    // A regular file is always readable and reads 0 bytes at its end, so
+    // lines, that are appended later, are read by later calls
+    char buffer[4096];
+    pollfd pfd{.fd = fd, .events = POLLIN};
+    while (::poll(&pfd, 1, 0) > 0 && (pfd.revents & POLLIN)) {
+        ssize_t size = read(fd, buffer, sizeof(buffer));
+        if (size <= 0) {
+            break;
+        }
+        pending.append(buffer, size);
+    }
+
+    std::vector<std::string> lines;
+    size_t begin = 0;
+    for (size_t end; (end = pending.find('\n', begin)) != std::string::npos; begin = end + 1) {
+        std::string line = pending.substr(begin, end - begin);
+        if (line.find_first_not_of(' ') == std::string::npos || line.starts_with("//")) {
+            continue;
+        }
+        lines.push_back(std::move(line));
+    }
+    pending.erase(0, begin);
+    return lines;
+}
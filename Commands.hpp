@@ -0,0 +1,40 @@
+#pragma once
+
+#include "Simulation.hpp"
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+/// Applies a command, that edits a live simulation between ticks:
+///     fill <x0> <y0> <x1> <y1> <c>
+///         cells of rows x0..x1 and columns y0..y1 (inclusive) become c:
+///         '#' places walls, ' ' (air) or a fluid removes them or injects
+///         the fluid
+///     g <value>
+///     rho <c> <value>
+/// The characters are taken as is, like in the scenario, so c may be a
+/// space. Throws, if the command is malformed or can not be applied.
+void apply_command(Simulation& simulation, std::string_view command);
+
+/// Source of commands: a file, that is appended to, a FIFO or stdin ("-").
+/// It is read without blocking, so it may be polled between ticks.
+class CommandChannel {
+    public:
+        explicit CommandChannel(const std::string& path);
+
+        CommandChannel(const CommandChannel&) = delete;
+        CommandChannel& operator=(const CommandChannel&) = delete;
+
+        ~CommandChannel();
+
+        /// Complete lines, that have arrived since the last call. Empty lines
+        /// and comments ("//") are skipped.
+        std::vector<std::string> poll();
+
+    private:
+        int fd;
+        bool own_fd;
+        /// Incomplete last line
+        std::string pending;
+};
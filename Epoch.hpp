@@ -0,0 +1,18 @@
+#pragma once
+
+#include <limits>
+
+/// Advances a narrow epoch counter by step. Entries are tagged with the epoch,
+/// in which they were written, so entries of older epochs are cleared
+/// without touching them. Instead of wrapping around (old tags would become
+/// current again), the counter restarts from step and true is returned: all
+/// tags must be cleared for real then.
+template<typename T>
+[[nodiscard]] bool advance_epoch(T& epoch, T step = 1) {
+    if (epoch > std::numeric_limits<T>::max() - step) {
+        epoch = step;
+        return true;
+    }
+    epoch += step;
+    return false;
+}
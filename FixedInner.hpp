@@ -1,23 +1,39 @@
 #pragma once
 
 #include <algorithm>
+#include <compare>
 #include <ostream>
 #include <istream>
 #include <type_traits>
 #include <climits>
 
+/// Storage-only number types, that are widened to FixedInner for arithmetic,
+/// see PackedFixed
+template<typename T>
+struct IsPackedFixed {
+    static constexpr bool value = false;
+};
+
+/// Type, in which values of T are computed
+template<typename T>
+struct ComputeType {
+    using type = T;
+};
+
 template<typename T, size_t K>
 requires (sizeof(T) * CHAR_BIT >= K)
 struct FixedInner {
     using type = T;
     static constexpr size_t k = K;
 
-    constexpr FixedInner(int v): v(v << K) {}
-    constexpr FixedInner(float f): v(f * (1 << K)) {}
-    constexpr FixedInner(double f): v(f * (1 << K)) {}
+    constexpr FixedInner(int v): v((T) v << K) {}
+    constexpr FixedInner(float f): v(f * ((T) 1 << K)) {}
+    constexpr FixedInner(double f): v(f * ((T) 1 << K)) {}
     constexpr FixedInner(): v(0) {}
 
-    constexpr operator double() const { return (double)v / (1 << K); }
+    /// Explicit, so that no floating point sneaks into fixed point kernels
+    constexpr explicit operator double() const { return (double)v / ((T) 1 << K); }
+    constexpr explicit operator float() const { return (float) (double) *this; }
 
     template<typename T2, size_t K2>
     constexpr FixedInner(const FixedInner<T2, K2>& other) {
@@ -30,6 +46,10 @@ struct FixedInner {
         }
     }
 
+    template<typename P>
+    requires IsPackedFixed<P>::value
+    constexpr FixedInner(const P& packed): FixedInner(packed.widen()) {}
+
     static constexpr FixedInner from_raw(T x) {
         FixedInner ret;
         ret.v = x;
@@ -80,7 +100,8 @@ struct IsFixedInner<FixedInner<T, K>> {
 
 template<typename T1, typename T2>
 struct IsEitherFixedInner {
-    static constexpr bool value = IsFixedInner<T1>::value || IsFixedInner<T2>::value;
+    static constexpr bool value = IsFixedInner<T1>::value || IsFixedInner<T2>::value
+        || IsPackedFixed<T1>::value || IsPackedFixed<T2>::value;
 };
 
 template<typename T1, typename T2>
@@ -111,26 +132,59 @@ CommonTypeFixed<T1, T2>::type operator/(T1 lhs, T2 rhs) {
     return res_t::from_raw(((int64_t) res_t(lhs).v << res_t::k) / res_t(rhs).v);
 }
 
+/// Fixed point and integers are compared by raw values in the common type
+template<typename T1, typename T2>
+requires IsEitherFixedInner<T1, T2>::value
+    && (!std::is_floating_point_v<T1>) && (!std::is_floating_point_v<T2>)
+constexpr bool operator==(T1 lhs, T2 rhs) {
+    using res_t = CommonTypeFixed<T1, T2>::type;
+    return res_t(lhs).v == res_t(rhs).v;
+}
+
+template<typename T1, typename T2>
+requires IsEitherFixedInner<T1, T2>::value
+    && (!std::is_floating_point_v<T1>) && (!std::is_floating_point_v<T2>)
+constexpr std::strong_ordering operator<=>(T1 lhs, T2 rhs) {
+    using res_t = CommonTypeFixed<T1, T2>::type;
+    return res_t(lhs).v <=> res_t(rhs).v;
+}
+
+/// Comparison with floating point is done in double, as the floating point
+/// operand may be not representable in fixed point
+template<typename T1, typename T2>
+requires IsEitherFixedInner<T1, T2>::value
+    && (std::is_floating_point_v<T1> || std::is_floating_point_v<T2>)
+constexpr bool operator==(T1 lhs, T2 rhs) {
+    return static_cast<double>(lhs) == static_cast<double>(rhs);
+}
+
 template<typename T1, typename T2>
 requires IsEitherFixedInner<T1, T2>::value
+    && (std::is_floating_point_v<T1> || std::is_floating_point_v<T2>)
+constexpr std::partial_ordering operator<=>(T1 lhs, T2 rhs) {
+    return static_cast<double>(lhs) <=> static_cast<double>(rhs);
+}
+
+template<typename T1, typename T2>
+requires IsEitherFixedInner<T1, T2>::value && (!IsPackedFixed<T1>::value)
 T1& operator+=(T1& lhs, T2 rhs) {
     return lhs = lhs + (T1)rhs;
 }
 
 template<typename T1, typename T2>
-requires IsEitherFixedInner<T1, T2>::value
+requires IsEitherFixedInner<T1, T2>::value && (!IsPackedFixed<T1>::value)
 T1& operator-=(T1& lhs, T2 rhs) {
     return lhs = lhs - (T1)rhs;
 }
 
 template<typename T1, typename T2>
-requires IsEitherFixedInner<T1, T2>::value
+requires IsEitherFixedInner<T1, T2>::value && (!IsPackedFixed<T1>::value)
 T1& operator*=(T1& lhs, T2 rhs) {
     return lhs = lhs * (T1)rhs;
 }
 
 template<typename T1, typename T2>
-requires IsEitherFixedInner<T1, T2>::value
+requires IsEitherFixedInner<T1, T2>::value && (!IsPackedFixed<T1>::value)
 T1& operator/=(T1& lhs, T2 rhs) {
     return lhs = lhs / (T1)rhs;
 }
@@ -148,9 +202,16 @@ FixedInner<T, K> abs(FixedInner<T, K> x) {
     return x;
 }
 
+/// Converts a floating point constant to T at compile time, e.g.
+/// force *= constant<decltype(force)>(0.8)
+template<typename T>
+consteval T constant(double x) {
+    return T(x);
+}
+
 template<typename T, size_t K>
 std::ostream& operator<<(std::ostream& out, FixedInner<T, K> x) {
-    return out << x.v / (double) (1 << K);
+    return out << x.v / (double) ((T) 1 << K);
 }
 
 template<typename T, size_t K>
@@ -1,23 +1,40 @@
 #pragma once
 
+#include "CellInfo.hpp"
+#include "Epoch.hpp"
+#include "Checkpoint.hpp"
 #include "FixedInner.hpp"
+#include "FluidOptions.hpp"
+#include "FluidSnapshot.hpp"
 #include "ParticleParams.hpp"
+#include "PerfCounters.hpp"
+#include "PhaseStats.hpp"
 #include "Matrix.hpp"
 #include "ThreadPool.hpp"
 #include "VectorField.hpp"
+#include "type_utils.hpp"
 #include "Rnd.hpp"
+#include "Scheduler.hpp"
+#include "StateHash.hpp"
+#include "SteadyState.hpp"
 
 #include <concepts>
 #include <cstring>
 #include <cassert>
+#include <cmath>
 #include <iostream>
+#include <limits>
 #include <algorithm>
+#include <chrono>
 #include <memory>
 #include <mutex>
+#include <optional>
 #include <sstream>
 #include <fstream>
 #include <stdexcept>
 #include <string>
+#include <thread>
+#include <vector>
 
 template<typename P_TYPE, typename V_TYPE>
 class ParticleParams;
@@ -25,29 +42,356 @@ class ParticleParams;
 template<typename P_TYPE, typename V_TYPE, typename V_FLOW_TYPE>
 class Fluid {
     private:
-        using V_COMMON_TYPE = typename CommonTypeFixed<V_TYPE, V_FLOW_TYPE>::type;
+        // Storage types may be narrower than types of arithmetic, see
+        // PackedFixed
+        using P_COMPUTE_TYPE = typename ComputeType<P_TYPE>::type;
+        using V_COMPUTE_TYPE = typename ComputeType<V_TYPE>::type;
+        using V_FLOW_COMPUTE_TYPE = typename ComputeType<V_FLOW_TYPE>::type;
+        using V_COMMON_TYPE = typename CommonTypeFixed<V_COMPUTE_TYPE, V_FLOW_COMPUTE_TYPE>::type;
+
+#ifdef COMPACT_STATE
+        using last_use_t = uint16_t;
+#else
+        using last_use_t = int;
+#endif
 
     public:
-        Fluid(const std::string& filename) {
-            read_from_file(filename);
+        Fluid(const std::string& filename, const FluidOptions& options = {})
+          : options(options),
+            pool(init_pool()),
+            rnd(options.seed)
+        {
+            std::ifstream fin(filename);
+            if (!fin) {
+                throw std::runtime_error("failed to open file");
+            }
+            read(fin);
+            init_cells();
         }
 
-        void run(size_t ticks_count = 1'000'000, bool quiet = false) {
-            init_dirs();
+        /// Reads scenario in the same format as the file from the stream
+        Fluid(std::istream& in, const FluidOptions& options = {})
+          : options(options),
+            pool(init_pool()),
+            rnd(options.seed)
+        {
+            read(in);
+            init_cells();
+        }
+
+        /// Resumes from the checkpoint in options.storage_file, see
+        /// Storage::FILE. Types must be the same as of the saved simulation.
+        Fluid(ResumeTag, const FluidOptions& options)
+          : options(options),
+            pool(init_pool()),
+            rnd(options.seed)
+        {
+            resume();
+        }
 
-            for (size_t tick_num = 0; tick_num < ticks_count; ++tick_num) {
-                tick(tick_num, quiet);
+        /// The file of Storage::FILE is left as a checkpoint, unless a tick
+        /// has thrown. The leader of slabs lets the followers finish.
+        ~Fluid() {
+            if (options.slabs && options.slabs->is_leader()) {
+                try {
+                    if (in_tick) {
+                        // The followers wait at some barrier of the tick
+                        options.slabs->fail();
+                    } else {
+                        options.slabs->broadcast(false);
+                    }
+                } catch (const std::exception& e) {
+                    std::cerr << "Failed to finish slabs: " << e.what() << std::endl;
+                }
+            }
+            // Matrices of a tick, that has thrown, are partially updated, so
+            // the header is left incomplete
+            if (header == nullptr || in_tick) {
+                return;
+            }
+            try {
+                checkpoint();
+            } catch (const std::exception& e) {
+                std::cerr << "Failed to write checkpoint: " << e.what() << std::endl;
             }
         }
 
-    private:
-        /// Reads data from file (is used in the constructor)
-        void read_from_file(const std::string& filename) {
-            std::ifstream fin(filename);
-            if (!fin) {
-                throw std::runtime_error("failed to open file");
+        /// Writes the header and flushes the file of Storage::FILE, so that
+        /// the simulation can be resumed from it
+        void checkpoint() {
+            if (header == nullptr) {
+                throw std::runtime_error("checkpoints require file storage");
+            }
+            static_assert(sizeof(rho) <= sizeof(header->rho));
+            static_assert(sizeof(g) <= sizeof(header->g));
+
+            auto copy_name = [](char* to, std::string_view name) {
+                if (name.size() >= CheckpointHeader::TYPE_NAME_SIZE) {
+                    throw std::runtime_error("type name is too long for checkpoint");
+                }
+                std::memcpy(to, name.data(), name.size());
+                to[name.size()] = 0;
+            };
+            std::memcpy(header->magic, CheckpointHeader::MAGIC, sizeof(header->magic));
+            header->n = n;
+            header->m = m;
+            header->ticks_done = ticks_done;
+            header->ut = UT;
+            header->p_second = p_second;
+            copy_name(header->p_type, get_type_name<P_TYPE>());
+            copy_name(header->v_type, get_type_name<V_TYPE>());
+            copy_name(header->v_flow_type, get_type_name<V_FLOW_TYPE>());
+            std::memcpy(header->rho, rho, sizeof(rho));
+            std::memcpy(header->g, &g, sizeof(g));
+            auto state = rnd.state();
+            if (state.size() >= CheckpointHeader::RND_STATE_SIZE) {
+                throw std::runtime_error("random state is too long for checkpoint");
+            }
+            std::memcpy(header->rnd_state, state.c_str(), state.size() + 1);
+
+            // Data first, so that a complete header never precedes the data
+            // on disk
+            arena->get_buffer().sync();
+            header->complete = 1;
+            arena->get_buffer().sync(header, sizeof(*header));
+        }
+
+        const PhaseStats& get_phase_stats() const {
+            return phase_stats;
+        }
+
+        size_t get_n() const {
+            return n;
+        }
+
+        size_t get_m() const {
+            return m;
+        }
+
+        /// Number of ticks made
+        size_t get_tick() const {
+            return ticks_done;
+        }
+
+        /// N x M + 1, the last column is zero
+        const AbstractMatrix<char>& get_field() const {
+            return *field;
+        }
+
+        const AbstractMatrix<P_TYPE>& get_p() const {
+            return *p;
+        }
+
+        const AbstractMatrix<std::array<V_TYPE, deltas.size()>>& get_velocity() const {
+            return *velocity.v;
+        }
+
+        /// velocity_flow is cleared lazily, so it is read by cells
+        std::array<V_FLOW_TYPE, deltas.size()> get_velocity_flow(size_t x, size_t y) const {
+            return velocity_flow.get_cell(x, y);
+        }
+
+        FluidSnapshot snapshot() const {
+            FluidSnapshot ans{};
+            ans.n = n;
+            ans.m = m;
+            ans.field.reserve(n * m);
+            ans.p.reserve(n * m);
+            std::array<size_t, 256> cells{};
+            for (size_t x = 0; x < n; ++x) {
+                for (size_t y = 0; y < m; ++y) {
+                    char c = (*field)[x][y];
+                    ans.field.push_back(c);
+                    ans.p.push_back(static_cast<double>((*p)[x][y]));
+                    if (c != '#') {
+                        ans.center[(unsigned char) c] += x;
+                        ++cells[(unsigned char) c];
+                    }
+                }
+            }
+            for (size_t c = 0; c < cells.size(); ++c) {
+                if (cells[c] != 0) {
+                    ans.center[c] /= cells[c];
+                }
+            }
+            return ans;
+        }
+
+        /// Hashes field, p and velocity, blocks are hashed in parallel.
+        /// velocity_flow is not hashed: it is recomputed from scratch each
+        /// tick.
+        StateHash state_hash() const {
+            StateHash ans(n, m);
+            TaskGroup group(pool);
+            for (size_t i = 0; i < ans.blocks.size(); ++i) {
+                group.add_task([this, &ans, i] {
+                    size_t bx = i / ans.blocks_m() * StateHash::BLOCK;
+                    size_t by = i % ans.blocks_m() * StateHash::BLOCK;
+                    uint64_t h = 0;
+                    for (size_t x = bx; x < std::min(n, bx + StateHash::BLOCK); ++x) {
+                        for (size_t y = by; y < std::min(m, by + StateHash::BLOCK); ++y) {
+                            h ^= StateHash::key(x, y, StateHash::FIELD, 0, (unsigned char) (*field)[x][y]);
+                            h ^= StateHash::key(x, y, StateHash::P, 0, StateHash::raw_bits((*p)[x][y]));
+                            const auto& v = (*velocity.v)[x][y];
+                            for (size_t d = 0; d < deltas.size(); ++d) {
+                                h ^= StateHash::key(x, y, StateHash::VELOCITY, d, StateHash::raw_bits(v[d]));
+                            }
+                        }
+                    }
+                    ans.blocks[i] = h;
+                });
+            }
+            group.wait();
+            for (uint64_t h : ans.blocks) {
+                ans.total ^= h;
+            }
+            return ans;
+        }
+
+        /// Runs simulation for ticks_count ticks or until steady state is
+        /// reached. Returns the tick at which the steady state was detected.
+        std::optional<size_t> run(
+            size_t ticks_count = 1'000'000,
+            bool quiet = false,
+            const SteadyCriteria& criteria = {}
+        ) {
+            set_steady_criteria(criteria);
+
+            for (size_t i = 0; i < ticks_count; ++i) {
+                step(quiet);
+
+                if (is_steady()) {
+                    return ticks_done - 1;
+                }
+            }
+
+            return std::nullopt;
+        }
+
+        /// Performs a single tick. Returns true, if any particle has moved.
+        /// If not quiet, the field is printed after each move.
+        /// With slabs is called by the leader only, see follow.
+        bool step(bool quiet = true) {
+            if (options.slabs) {
+                options.slabs->broadcast(true);
+            }
+            return tick(ticks_done++, quiet);
+        }
+
+        /// Makes the ticks of a follower of slabs along with the steps of
+        /// the leader, until the leader is destroyed
+        void follow() {
+            if (!options.slabs || options.slabs->is_leader()) {
+                throw std::runtime_error("only followers of slabs follow");
+            }
+            while (options.slabs->broadcast(false)) {
+                tick(ticks_done++, true);
+            }
+        }
+
+        /// Resets steady state detection, see is_steady
+        void set_steady_criteria(const SteadyCriteria& criteria) {
+            // Per-tile values of other slabs are not seen
+            if (options.slabs && criteria.enabled()) {
+                throw std::runtime_error("steady state detection is not supported with slabs");
+            }
+            steady_criteria = criteria;
+            steady = SteadyState{};
+        }
+
+        /// Checks if the last tick has reached the steady state
+        bool is_steady() const {
+            return steady.satisfies(steady_criteria);
+        }
+
+        /// Sets cells of rows [x_begin, x_end) and columns [y_begin, y_end)
+        /// to c between ticks: '#' places walls, other characters remove
+        /// them or inject fluid. Changed cells start at rest (zero p and
+        /// velocities). Only the rectangle and its border are updated, the
+        /// rest of the grid is not visited.
+        void fill(size_t x_begin, size_t y_begin, size_t x_end, size_t y_end, char c) {
+            check_editable();
+            if (x_begin >= x_end || y_begin >= y_end || x_end > n || y_end > m) {
+                throw std::runtime_error("rectangle is out of the field");
+            }
+            if (c != '#' && rho[(unsigned char) c] == 0) {
+                throw std::runtime_error(std::string("rho of '") + c + "' is not set");
+            }
+            // Checked before anything is changed
+            for (size_t x = x_begin; x < x_end; ++x) {
+                for (size_t y = y_begin; y < y_end; ++y) {
+                    if (c == '#' || (*field)[x][y] != '#') {
+                        continue;
+                    }
+                    if (x == 0 || x == n - 1 || y == 0 || y == m - 1) {
+                        throw std::runtime_error("cells on the border of the field are walls");
+                    }
+                    // Walls only chunks have no storage
+                    if (chunks && !chunks->is_active(x / ChunkMap::CHUNK, y / ChunkMap::CHUNK)) {
+                        throw std::runtime_error("walls of unstored chunks can not be removed");
+                    }
+                }
             }
 
+            invalidate_checkpoint();
+            for (size_t x = x_begin; x < x_end; ++x) {
+                for (size_t y = y_begin; y < y_end; ++y) {
+                    if ((*field)[x][y] == c) {
+                        continue;
+                    }
+                    bool topology = (c == '#') != ((*field)[x][y] == '#');
+                    (*field)[x][y] = c;
+                    if (!topology) {
+                        // A fluid is replaced by another one
+                        continue;
+                    }
+                    (*p)[x][y] = P_TYPE{};
+                    (*old_p)[x][y] = P_TYPE{};
+                    (*velocity.v)[x][y] = {};
+                    // Nothing flows into a wall
+                    for (auto [dx, dy] : deltas) {
+                        if ((*field)[x + dx][y + dy] != '#') {
+                            velocity.get(x + dx, y + dy, -dx, -dy) = V_TYPE{};
+                        }
+                    }
+                }
+            }
+
+            // Masks of neighbours change on the border of the rectangle too
+            for (size_t x = x_begin == 0 ? 0 : x_begin - 1; x < std::min(n, x_end + 1); ++x) {
+                for (size_t y = y_begin == 0 ? 0 : y_begin - 1; y < std::min(m, y_end + 1); ++y) {
+                    if ((*field)[x][y] != '#') {
+                        (*cells)[x][y] = cell_info(x, y);
+                    } else if (!(*cells)[x][y].is_wall()) {
+                        (*cells)[x][y] = CellInfo::wall();
+                    }
+                }
+            }
+            steady = SteadyState{};
+        }
+
+        /// Changes gravity between ticks
+        void set_g(double value) {
+            check_editable();
+            invalidate_checkpoint();
+            g = V_COMPUTE_TYPE(value);
+            steady = SteadyState{};
+        }
+
+        /// Changes density of c between ticks
+        void set_rho(char c, double value) {
+            check_editable();
+            if (c == '#' || value <= 0) {
+                throw std::runtime_error("rho should be positive and of a fluid");
+            }
+            invalidate_checkpoint();
+            rho[(unsigned char) c] = P_COMPUTE_TYPE(value);
+            steady = SteadyState{};
+        }
+
+    private:
+        /// Reads scenario (is used in the constructors)
+        void read(std::istream& fin) {
             std::string line;
             std::stringstream ss;
 
@@ -75,13 +419,7 @@ class Fluid {
             }
 
             // Field
-            field.reset(create_matrix<char>{}(n, m + 1));
-            p.reset(create_matrix<P_TYPE>{}(n, m));
-            old_p.reset(create_matrix<P_TYPE>{}(n, m));
-            last_use.reset(create_matrix<int>{}(n, m));
-            dirs.reset(create_matrix<int>{}(n, m));
-            velocity = VectorField<V_TYPE>{n, m};
-            velocity_flow = VectorField<V_FLOW_TYPE>{n, m};
+            std::vector<std::string> field_lines(n);
             for (size_t i = 0; i < n; ++i) {
                 if (!read_line()) {
                     throw std::runtime_error("failed to read field");
@@ -89,10 +427,9 @@ class Fluid {
                 if (line.size() != m) {
                     throw std::runtime_error("wrong length of fileld row");
                 }
-                for (size_t j = 0; j < m; ++j) {
-                    (*field)[i][j] = line[j];
-                }
+                field_lines[i] = line;
             }
+            init_storage(field_lines);
 
             // G
             if (!read_line()) {
@@ -117,75 +454,456 @@ class Fluid {
             }
         }
 
-        /// Inits dirs matrix
-        void init_dirs() {
-            forall([this](size_t x, size_t y){
-                if ((*field)[x][y] == '#')
+        /// Creates all matrices and fills field. With NumaPolicy::FIRST_TOUCH
+        /// cells of each tile are constructed by the thread, that owns it.
+        /// With Storage::CHUNKED chunks of walls only are not stored and not
+        /// visited.
+        void init_storage(const std::vector<std::string>& field_lines) {
+            std::unique_ptr<ChunkMap> field_chunks = nullptr;
+            if (options.storage == Storage::CHUNKED) {
+                chunks = std::make_unique<ChunkMap>(n, m, [&field_lines](size_t x, size_t y) {
+                    return field_lines[x][y] != '#';
+                });
+                // The extra column of field always has real storage
+                field_chunks = std::make_unique<ChunkMap>(n, m + 1, [this, &field_lines](size_t x, size_t y) {
+                    return y == m || field_lines[x][y] != '#';
+                });
+            }
+            create_matrices(field_chunks.get(), false);
+
+            scheduler->forall<Footprint::OWN>([this, &field_lines](size_t x, size_t y) {
+                new (&(*p)[x][y]) P_TYPE{};
+                new (&(*old_p)[x][y]) P_TYPE{};
+                new (&(*last_use)[x][y]) last_use_t{};
+                new (&(*cells)[x][y]) CellInfo{};
+                new (&(*velocity.v)[x][y]) std::array<V_TYPE, deltas.size()>{};
+                new (&(*velocity_flow.values.v)[x][y]) std::array<V_FLOW_TYPE, deltas.size()>{};
+                new (&(*velocity_flow.tags)[x][y]) last_use_t{};
+                (*field)[x][y] = field_lines[x][y];
+            });
+            // Extra column of field
+            serial([this] {
+                for (size_t x = 0; x < n; ++x) {
+                    (*field)[x][m] = 0;
+                }
+            });
+        }
+
+        /// Memory of a rows x cols matrix of the current storage
+        template<typename T>
+        size_t matrix_bytes(size_t rows, size_t cols, const ChunkMap* map) const {
+            if (map != nullptr) {
+                return ChunkedMatrix<T>::bytes(*map);
+            }
+            if (options.storage == Storage::FILE) {
+                return DynamicMatrix<T, tile_ordered_layout>::bytes(rows, cols);
+            }
+            return DynamicMatrix<T>::bytes(rows, cols);
+        }
+
+        /// Creates all matrices without filling them. If existing is set, the
+        /// file of Storage::FILE is mapped as is, otherwise it is created.
+        void create_matrices(const ChunkMap* field_chunks, bool existing) {
+            bool file = options.storage == Storage::FILE;
+            if (options.slabs && options.storage != Storage::DENSE) {
+                throw std::runtime_error("slabs require dense storage");
+            }
+            MatrixOptions matrix_options {
+                // With slabs each process initializes its own rows
+                .deferred_init = existing || options.slabs || options.numa == NumaPolicy::FIRST_TOUCH,
+                .numa_interleave = options.numa == NumaPolicy::INTERLEAVE,
+                .tile_ordered = file,
+            };
+            if (options.arena || file || options.slabs) {
+                size_t capacity
+                    = Arena::slice_size(matrix_bytes<char>(n, m + 1, field_chunks))
+                    + 2 * Arena::slice_size(matrix_bytes<P_TYPE>(n, m, chunks.get()))
+                    + Arena::slice_size(matrix_bytes<last_use_t>(n, m, chunks.get()))
+                    + Arena::slice_size(matrix_bytes<CellInfo>(n, m, chunks.get()))
+                    + Arena::slice_size(matrix_bytes<std::array<V_TYPE, deltas.size()>>(n, m, chunks.get()))
+                    + Arena::slice_size(matrix_bytes<std::array<V_FLOW_TYPE, deltas.size()>>(n, m, chunks.get()))
+                    + Arena::slice_size(matrix_bytes<last_use_t>(n, m, chunks.get()));
+                if (file) {
+                    capacity += Arena::slice_size(sizeof(CheckpointHeader));
+                    arena = std::make_unique<Arena>(PageBuffer::map_file(options.storage_file, capacity, !existing));
+                    // The header is the first slice, matrices follow in the
+                    // order below
+                    header = static_cast<CheckpointHeader*>(arena->allocate(sizeof(CheckpointHeader)));
+                } else if (options.slabs) {
+                    arena = std::make_unique<Arena>(options.slabs->map_data(capacity));
+                } else {
+                    arena = std::make_unique<Arena>(capacity, matrix_options.numa_interleave, options.huge_pages);
+                }
+                matrix_options.arena = arena.get();
+            }
+
+            if (chunks) {
+                std::cout << "Using ChunkedMatrix: " << chunks->get_active_count() << " of "
+                    << chunks->get_chunks_n() * chunks->get_chunks_m() << " chunks" << std::endl;
+                // Walls of field are never written, so it is filled by the
+                // matrix even with deferred init
+                auto field_options = matrix_options;
+                field_options.deferred_init = false;
+                field.reset(new ChunkedMatrix<char>(*field_chunks, '#', field_options));
+                p.reset(new ChunkedMatrix<P_TYPE>(*chunks, P_TYPE{}, matrix_options));
+                old_p.reset(new ChunkedMatrix<P_TYPE>(*chunks, P_TYPE{}, matrix_options));
+                last_use.reset(new ChunkedMatrix<last_use_t>(*chunks, last_use_t{}, matrix_options));
+                cells.reset(new ChunkedMatrix<CellInfo>(*chunks, CellInfo::wall(), matrix_options));
+                velocity = VectorField<V_TYPE>{
+                    new ChunkedMatrix<std::array<V_TYPE, deltas.size()>>(*chunks, {}, matrix_options)
+                };
+                velocity_flow = LazyVectorField<V_FLOW_TYPE, last_use_t>{
+                    new ChunkedMatrix<std::array<V_FLOW_TYPE, deltas.size()>>(*chunks, {}, matrix_options),
+                    new ChunkedMatrix<last_use_t>(*chunks, last_use_t{}, matrix_options)
+                };
+            } else {
+                field.reset(create_matrix<char>{}(n, m + 1, matrix_options));
+                p.reset(create_matrix<P_TYPE>{}(n, m, matrix_options));
+                old_p.reset(create_matrix<P_TYPE>{}(n, m, matrix_options));
+                last_use.reset(create_matrix<last_use_t>{}(n, m, matrix_options));
+                cells.reset(create_matrix<CellInfo>{}(n, m, matrix_options));
+                velocity = VectorField<V_TYPE>{n, m, matrix_options};
+                velocity_flow = LazyVectorField<V_FLOW_TYPE, last_use_t>{n, m, matrix_options};
+            }
+
+            // A tile of the scheduler is a single tile of the file layout
+            size_t tile_n = file ? tile_ordered_layout::TILE : options.tile_n;
+            size_t tile_m = file ? tile_ordered_layout::TILE : options.tile_m;
+            scheduler = std::make_unique<TileScheduler>(
+                pool, n, m, tile_n, tile_m,
+                options.numa == NumaPolicy::FIRST_TOUCH,
+                chunks.get()
+            );
+            tile_max_dp.resize(scheduler->tiles_count());
+            tile_energy.resize(scheduler->tiles_count());
+            tile_movable.resize(scheduler->tiles_count());
+
+            if (options.slabs) {
+                auto [x_begin, x_end] = options.slabs->slab(n, tile_n);
+                scheduler->set_slab(x_begin, x_end, [slabs = options.slabs] {
+                    slabs->barrier();
+                });
+            }
+
+            if (file) {
+                // Page the tiles of all matrices in ahead of a task and let
+                // them go after it, so the OS streams the file tile by tile
+                auto hint = [this](const Tile& tile, Access access) {
+                    auto advise = [&tile, access](const auto& matrix) {
+                        matrix->advise(tile.x_begin, tile.x_end, tile.y_begin, tile.y_end, access);
+                    };
+                    advise(field);
+                    advise(p);
+                    advise(old_p);
+                    advise(last_use);
+                    advise(cells);
+                    advise(velocity.v);
+                    advise(velocity_flow.values.v);
+                    advise(velocity_flow.tags);
+                };
+                scheduler->set_tile_hooks(
+                    [hint](const Tile& tile) { hint(tile, Access::WILL_NEED); },
+                    [hint](const Tile& tile) { hint(tile, Access::COLD); }
+                );
+            }
+        }
+
+        /// Maps the file of a checkpoint, that was left by checkpoint()
+        void resume() {
+            if (options.storage != Storage::FILE) {
+                throw std::runtime_error("resume requires file storage");
+            }
+
+            CheckpointHeader saved;
+            std::ifstream fin(options.storage_file, std::ios::binary);
+            if (!fin.read(reinterpret_cast<char*>(&saved), sizeof(saved))) {
+                throw std::runtime_error("failed to read checkpoint");
+            }
+            if (std::memcmp(saved.magic, CheckpointHeader::MAGIC, sizeof(saved.magic)) != 0) {
+                throw std::runtime_error("not a checkpoint");
+            }
+            if (!saved.complete) {
+                throw std::runtime_error("checkpoint was left in the middle of a tick");
+            }
+            if (get_type_name<P_TYPE>() != saved.p_type
+                || get_type_name<V_TYPE>() != saved.v_type
+                || get_type_name<V_FLOW_TYPE>() != saved.v_flow_type) {
+                throw std::runtime_error("checkpoint has other types");
+            }
+
+            n = saved.n;
+            m = saved.m;
+            create_matrices(nullptr, true);
+            // The epoch of the saved flow is not kept
+            velocity_flow.clear_tags();
+            // Matrices are mapped in the order of allocation
+            if (header->p_second) {
+                swap_p();
+            }
+
+            ticks_done = header->ticks_done;
+            UT = header->ut;
+            std::memcpy(rho, header->rho, sizeof(rho));
+            std::memcpy(&g, header->g, sizeof(g));
+            rnd.set_state(header->rnd_state);
+        }
+
+        /// Inits cells matrix: walls, dirs and masks of non-wall neighbours
+        void init_cells() {
+            scheduler->forall<Footprint::OWN>([this](size_t x, size_t y){
+                if ((*field)[x][y] == '#') {
+                    (*cells)[x][y] = CellInfo::wall();
                     return;
-                for (auto [dx, dy] : deltas) {
-                    (*dirs)[x][y] += ((*field)[x + dx][y + dy] != '#');
                 }
+                (*cells)[x][y] = cell_info(x, y);
             });
         }
 
+        /// Topology of a non-wall cell
+        /// Reads:
+        ///     field
+        CellInfo cell_info(size_t x, size_t y) const {
+            unsigned open_mask = 0;
+            for (size_t i = 0; i < deltas.size(); ++i) {
+                auto [dx, dy] = deltas[i];
+                open_mask |= ((*field)[x + dx][y + dy] != '#') << i;
+            }
+            return CellInfo::from_open_mask(open_mask);
+        }
+
+        /// Marks the checkpoint of Storage::FILE incomplete on disk before
+        /// its data is changed. Otherwise dirty pages of the data could be
+        /// written back before the header, and a crash would leave a complete
+        /// header over partial data.
+        void invalidate_checkpoint() {
+            if (header == nullptr || !header->complete) {
+                return;
+            }
+            header->complete = 0;
+            arena->get_buffer().sync(header, sizeof(*header));
+        }
+
+        /// Edits are made between ticks by the process, that owns all the
+        /// state
+        void check_editable() const {
+            if (in_tick) {
+                throw std::runtime_error("simulation can not be edited during a tick");
+            }
+            // rho and g are not shared with the followers
+            if (options.slabs) {
+                throw std::runtime_error("edits are not supported with slabs");
+            }
+        }
+
         /// Performs single tick
-        void tick(size_t tick_num, bool quiet = false) {
-            apply_gravity();
-            apply_p_forces();
-            recalc_flow();
+        bool tick(size_t tick_num, bool quiet = false) {
+            invalidate_checkpoint();
+            in_tick = true;
+
+            if (options.perf_counters && !perf) {
+                init_perf();
+            }
+            CounterValues counters_start{};
+            if (perf) {
+                counters_start = perf->read();
+            }
+
+            auto start = PhaseStats::clock::now();
+            auto end_phase = [this, &start, &counters_start](Phase phase) {
+                auto end = PhaseStats::clock::now();
+                phase_stats[phase] += end - start;
+                start = end;
+                if (perf) {
+                    auto counters_end = perf->read();
+                    for (size_t i = 0; i < COUNTERS_COUNT; ++i) {
+                        phase_stats.counters[(size_t) phase][i] += counters_end[i] - counters_start[i];
+                    }
+                    counters_start = counters_end;
+                }
+            };
+
+            if (options.fuse_phases) {
+                apply_forces_fused();
+            } else {
+                apply_gravity();
+                apply_p_forces();
+            }
+            end_phase(Phase::FORCES);
+            // Each process of slabs has its own epoch of velocity_flow
+            reset_flow();
+            serial([this] {
+                recalc_flow();
+            });
+            end_phase(Phase::RECALC_FLOW);
             recalc_p();
+            end_phase(Phase::RECALC_P);
 
-            if (maybe_propagate() && !quiet) {
+            bool moved = false;
+            serial([this, &moved] {
+                moved = maybe_propagate();
+            });
+            end_phase(Phase::PROPAGATE);
+            ++phase_stats.ticks;
+            if (moved && !quiet) {
                 std::cout
                     << "Tick " << tick_num << ":\n"
                     << *field << std::endl;
             }
+
+            if (steady_criteria.enabled()) {
+                update_steady_state(moved);
+            }
+            if (options.metrics) {
+                options.metrics->publish(phase_stats);
+            }
+            in_tick = false;
+            return moved;
+        }
+
+        /// Reduces per-tile values, collected by apply_p_forces and recalc_p
+        /// Reads:
+        ///     tile_max_dp, tile_energy
+        /// Writes:
+        ///     steady
+        void update_steady_state(bool moved) {
+            steady.still_ticks = moved ? 0 : steady.still_ticks + 1;
+            steady.max_dp = 0;
+            steady.energy = 0;
+            for (size_t i = 0; i < scheduler->tiles_count(); ++i) {
+                steady.max_dp = std::max(steady.max_dp, tile_max_dp[i]);
+                steady.energy += tile_energy[i];
+            }
         }
 
         /// Apply external forces
         /// Reads:
-        ///     field
+        ///     cells
         /// Writes:
         ///     velocity
         void apply_gravity() {
-            forall([this](size_t x, size_t y) {
-                if ((*field)[x][y] == '#')
-                    return;
-                if ((*field)[x + 1][y] != '#')
-                    velocity.add(x, y, 1, 0, g);
+            scheduler->forall<Footprint::OWN>([this](size_t x, size_t y) {
+                apply_gravity_cell(x, y);
             });
         }
 
+        /// Swaps the buffers of p, see apply_p_forces
+        void swap_p() {
+            std::swap(p, old_p);
+            p_second = !p_second;
+        }
+
         /// Apply forces from p
+        /// p and old_p are two buffers of a double buffer: old_p is a read-only
+        /// snapshot of p at the start of the phase and p is fully rewritten
+        /// from it, so no separate copy pass is needed.
         /// Reads:
-        ///     p, velocity
+        ///     old_p, velocity
         /// Writes:
-        ///     velocity
+        ///     p, velocity, tile_max_dp
         void apply_p_forces() {
-            forall([this](size_t x, size_t y) -> void {
-                (*old_p)[x][y] = (*p)[x][y];
+            swap_p();
+
+            bool track = steady_criteria.enabled();
+            scheduler->forall_tiles<Footprint::NEIGHBOURS>([this, track](const Tile& tile) {
+                apply_p_forces_tile(tile, track);
             });
+        }
 
-            forall([this](size_t x, size_t y) -> void {
-                if ((*field)[x][y] == '#')
-                    return;
-                for (auto [dx, dy] : deltas) {
-                    int nx = x + dx, ny = y + dy;
-                    if ((*field)[nx][ny] != '#' && (*old_p)[nx][ny] < (*old_p)[x][y]) {
-                        auto delta_p = (*old_p)[x][y] - (*old_p)[nx][ny];
-                        auto force = delta_p;
-                        auto &contr = velocity.get(nx, ny, -dx, -dy);
-                        if (contr * rho[(int) ((*field)[nx][ny])] >= force) {
-                            contr -= force / rho[(int) ((*field)[nx][ny])];
-                            continue;
+        /// Same as apply_gravity followed by apply_p_forces, but in a single
+        /// pass: tiles are still hot in cache, when forces from p are applied.
+        ///
+        /// Gravity writes the down velocity of a cell, which is read only by
+        /// forces from p of the cell below (other writes to it are additions
+        /// and commute with gravity). So gravity for a cell is applied by the
+        /// task of the tile, that contains the cell below, right before forces
+        /// from p. These cells are the row above the tile and all rows of the
+        /// tile but the last one, so each cell gets gravity exactly once, tiles
+        /// of the same color do not overlap and the result is exactly the same
+        /// as of the two separate phases.
+        /// Reads:
+        ///     cells, old_p, velocity
+        /// Writes:
+        ///     p, velocity, tile_max_dp
+        void apply_forces_fused() {
+            swap_p();
+
+            bool track = steady_criteria.enabled();
+            scheduler->forall_tiles<Footprint::NEIGHBOURS>([this, track](const Tile& tile) {
+                size_t x_begin = tile.x_begin == 0 ? 0 : tile.x_begin - 1;
+                // The last row has no cell below
+                size_t x_end = tile.x_end == n ? n : tile.x_end - 1;
+                for (size_t x = x_begin; x < x_end; ++x) {
+                    for (size_t y = tile.y_begin; y < tile.y_end; ++y) {
+                        apply_gravity_cell(x, y);
+                    }
+                }
+                apply_p_forces_tile(tile, track);
+            });
+        }
+
+        /// Reads:
+        ///     cells
+        /// Writes:
+        ///     velocity
+        void apply_gravity_cell(size_t x, size_t y) {
+            auto cell = (*cells)[x][y];
+            if (cell.is_wall())
+                return;
+            if (cell.is_open(delta_index(1, 0)))
+                velocity.add(x, y, 1, 0, g);
+        }
+
+        /// Reads:
+        ///     old_p, velocity
+        /// Writes:
+        ///     p, velocity, tile_max_dp
+        void apply_p_forces_tile(const Tile& tile, bool track) {
+            P_COMPUTE_TYPE max_dp = 0;
+            for (size_t x = tile.x_begin; x < tile.x_end; ++x) {
+                for (size_t y = tile.y_begin; y < tile.y_end; ++y) {
+                    if (track) {
+                        // Stale value of p is the value from the previous tick
+                        P_COMPUTE_TYPE dp = (*old_p)[x][y] - (*p)[x][y];
+                        if (dp < 0) {
+                            dp = -dp;
                         }
-                        force -= contr * rho[(int) ((*field)[nx][ny])];
-                        contr = 0;
-                        velocity.add(x, y, dx, dy, force / rho[(int) ((*field)[x][y])]);
-                        (*p)[x][y] -= force / (*dirs)[x][y];
+                        max_dp = std::max(max_dp, dp);
                     }
+                    apply_p_forces_cell(x, y);
                 }
-          });
+            }
+            tile_max_dp[tile.index] = double(max_dp);
+        }
+
+        /// Reads:
+        ///     old_p, velocity
+        /// Writes:
+        ///     p, velocity
+        void apply_p_forces_cell(size_t x, size_t y) {
+            P_COMPUTE_TYPE cur_p = (*old_p)[x][y];
+            auto cell = (*cells)[x][y];
+            if (cell.is_wall()) {
+                (*p)[x][y] = cur_p;
+                return;
+            }
+            for (size_t i = 0; i < deltas.size(); ++i) {
+                auto [dx, dy] = deltas[i];
+                int nx = x + dx, ny = y + dy;
+                if (cell.is_open(i) && (*old_p)[nx][ny] < (*old_p)[x][y]) {
+                    auto delta_p = (*old_p)[x][y] - (*old_p)[nx][ny];
+                    auto force = delta_p;
+                    auto &contr = velocity.get(nx, ny, -dx, -dy);
+                    if (contr * rho[(int) ((*field)[nx][ny])] >= force) {
+                        contr -= force / rho[(int) ((*field)[nx][ny])];
+                        continue;
+                    }
+                    force -= contr * rho[(int) ((*field)[nx][ny])];
+                    contr = 0;
+                    velocity.add(x, y, dx, dy, force / rho[(int) ((*field)[x][y])]);
+                    cur_p -= force / cell.dirs();
+                }
+            }
+            (*p)[x][y] = cur_p;
         }
 
         /// Make flow from velocities
@@ -195,72 +913,135 @@ class Fluid {
         ///     UT
         /// TODO: inderect: propagate_flow
         void recalc_flow() {
-            velocity_flow.reset();
             bool prop = false;
             do {
-                UT += 2;
+                next_epoch();
+                ++phase_stats.flow_sweeps;
                 prop = 0;
-                for (size_t x = 0; x < n; ++x) {
-                    for (size_t y = 0; y < m; ++y) {
-                        if ((*field)[x][y] != '#' && (*last_use)[x][y] != UT) {
-                            auto [t, local_prop, _] = propagate_flow(x, y, 1);
-                            if (t > 0) {
-                                prop = 1;
-                            }
+                forall_serial([this, &prop](size_t x, size_t y) {
+                    if (!(*cells)[x][y].is_wall() && (*last_use)[x][y] != UT) {
+                        auto [t, local_prop, _] = propagate_flow(x, y, 1);
+                        if (t > 0) {
+                            prop = 1;
                         }
                     }
-                }
+                });
             } while (prop);
         }
 
-        /// Recalculate p with kinetic energy
+        /// Recalculate p with kinetic energy. Velocities are final for the
+        /// tick after it, so movable cells are collected here.
         /// Reads:
         ///     velocity, velocity_flow
         /// Writes:
-        ///     p
+        ///     p, tile_energy, tile_movable
         void recalc_p() {
-            forall([this](size_t x, size_t y) {
-                if ((*field)[x][y] == '#')
-                    return;
-                for (auto [dx, dy] : deltas) {
-                    auto old_v = velocity.get(x, y, dx, dy);
-                    auto new_v = velocity_flow.get(x, y, dx, dy);
-                    if (old_v > 0) {
-                        assert(new_v <= old_v);
-                        velocity.get(x, y, dx, dy) = new_v;
-                        auto force = (old_v - new_v) * rho[(int) ((*field)[x][y])];
-                        if ((*field)[x][y] == '.')
-                            force *= 0.8;
-                        if ((*field)[x + dx][y + dy] == '#') {
-                            (*p)[x][y] += force / (*dirs)[x][y];
-                        } else {
-                            (*p)[x + dx][y + dy] += force / (*dirs)[x + dx][y + dy];
+            bool track = steady_criteria.enabled();
+            scheduler->forall_tiles<Footprint::NEIGHBOURS>([this, track](const Tile& tile) {
+                double energy = 0;
+                auto& movable = tile_movable[tile.index];
+                movable.clear();
+                for (size_t x = tile.x_begin; x < tile.x_end; ++x) {
+                    for (size_t y = tile.y_begin; y < tile.y_end; ++y) {
+                        if (recalc_p_cell(x, y, track, energy)) {
+                            movable.emplace_back(x, y);
                         }
                     }
                 }
+                tile_energy[tile.index] = energy;
             });
         }
 
+        /// Returns true, if the cell is left with a positive velocity to an
+        /// open neighbour, i.e. may move
         /// Reads:
-        ///     last_use, UT
+        ///     velocity, velocity_flow
+        /// Writes:
+        ///     p
+        bool recalc_p_cell(size_t x, size_t y, bool track, double& energy) {
+            auto cell = (*cells)[x][y];
+            if (cell.is_wall())
+                return false;
+            bool movable = false;
+            for (size_t i = 0; i < deltas.size(); ++i) {
+                auto [dx, dy] = deltas[i];
+                auto old_v = velocity.get(x, y, dx, dy);
+                auto new_v = velocity_flow.get(x, y, dx, dy);
+                if (track) {
+                    double v = old_v > 0 ? double(new_v) : double(old_v);
+                    energy += double(rho[(int) ((*field)[x][y])]) * v * v / 2;
+                }
+                if (old_v > 0) {
+                    assert(new_v <= old_v);
+                    velocity.get(x, y, dx, dy) = V_TYPE(new_v);
+                    auto force = (old_v - new_v) * rho[(int) ((*field)[x][y])];
+                    if ((*field)[x][y] == '.')
+                        force *= constant<decltype(force)>(0.8);
+                    if (!cell.is_open(i)) {
+                        (*p)[x][y] += force / cell.dirs();
+                    } else {
+                        (*p)[x + dx][y + dy] += force / (*cells)[x + dx][y + dy].dirs();
+                        movable = movable || new_v > 0;
+                    }
+                }
+            }
+            return movable;
+        }
+
+        /// Cells, that are not movable (see recalc_p_cell), have zero
+        /// move_prob, so only movable ones need it. Propagate::EXACT still
+        /// visits all cells in row-major order for the same draws of rnd,
+        /// Propagate::FAST visits movable cells only.
+        /// Reads:
+        ///     last_use, UT, tile_movable
         /// Writes:
         ///     UT
         /// TODO: inderect: propagate_move, propagate_stop, move_prob
         bool maybe_propagate() {
-            UT += 2;
+            next_epoch();
             bool prop = false;
-            for (size_t x = 0; x < n; ++x) {
-                for (size_t y = 0; y < m; ++y) {
-                    if ((*field)[x][y] != '#' && (*last_use)[x][y] != UT) {
-                        if (Rnd::random01<V_TYPE>() < move_prob(x, y)) {
-                            prop = true;
-                            propagate_move(x, y, true);
-                        } else {
-                            propagate_stop(x, y, true);
-                        }
-                    }
+            auto visit = [this, &prop](size_t x, size_t y, bool movable) {
+                if ((*cells)[x][y].is_wall() || (*last_use)[x][y] == UT) {
+                    return;
                 }
+                auto prob = movable ? move_prob(x, y) : V_COMPUTE_TYPE(0);
+                if (rnd.random01<V_COMPUTE_TYPE>() < prob) {
+                    prop = true;
+                    ++phase_stats.moves;
+                    propagate_move(x, y, true);
+                } else {
+                    propagate_stop(x, y, true);
+                }
+            };
+
+            // Lists of other processes are not seen
+            if (options.slabs) {
+                forall_serial([&visit](size_t x, size_t y) {
+                    visit(x, y, true);
+                });
+                return prop;
+            }
+
+            movable_cells.clear();
+            for (const auto& movable : tile_movable) {
+                movable_cells.insert(movable_cells.end(), movable.begin(), movable.end());
+            }
+
+            if (options.propagate == Propagate::FAST) {
+                for (auto [x, y] : movable_cells) {
+                    visit(x, y, true);
+                }
+                return prop;
             }
+
+            // Tiles are not whole rows in general
+            std::ranges::sort(movable_cells);
+            size_t next = 0;
+            forall_serial([this, &visit, &next](size_t x, size_t y) {
+                bool movable = next < movable_cells.size() && movable_cells[next] == std::make_pair(x, y);
+                next += movable;
+                visit(x, y, movable);
+            });
             return prop;
         }
 
@@ -272,9 +1053,11 @@ class Fluid {
         std::tuple<V_COMMON_TYPE, bool, std::pair<int, int>> propagate_flow(int x, int y, V_COMMON_TYPE lim) {
             (*last_use)[x][y] = UT - 1;
             V_COMMON_TYPE ret = 0;
-            for (auto [dx, dy] : deltas) {
+            auto cell = (*cells)[x][y];
+            for (size_t i = 0; i < deltas.size(); ++i) {
+                auto [dx, dy] = deltas[i];
                 int nx = x + dx, ny = y + dy;
-                if ((*field)[nx][ny] != '#' && (*last_use)[nx][ny] < UT) {
+                if (cell.is_open(i) && (*last_use)[nx][ny] < UT) {
                     auto cap = velocity.get(x, y, dx, dy);
                     auto flow = velocity_flow.get(x, y, dx, dy);
                     if (flow == cap) {
@@ -308,11 +1091,13 @@ class Fluid {
         ///     last_use
         /// TODO: inderect: propagate_flow
         void propagate_stop(int x, int y, bool force = false) {
+            auto cell = (*cells)[x][y];
             if (!force) {
                 bool stop = true;
-                for (auto [dx, dy] : deltas) {
+                for (size_t i = 0; i < deltas.size(); ++i) {
+                    auto [dx, dy] = deltas[i];
                     int nx = x + dx, ny = y + dy;
-                    if ((*field)[nx][ny] != '#' && (*last_use)[nx][ny] < UT - 1 && velocity.get(x, y, dx, dy) > 0) {
+                    if (cell.is_open(i) && (*last_use)[nx][ny] < UT - 1 && velocity.get(x, y, dx, dy) > 0) {
                         stop = false;
                         break;
                     }
@@ -322,9 +1107,10 @@ class Fluid {
                 }
             }
             (*last_use)[x][y] = UT;
-            for (auto [dx, dy] : deltas) {
+            for (size_t i = 0; i < deltas.size(); ++i) {
+                auto [dx, dy] = deltas[i];
                 int nx = x + dx, ny = y + dy;
-                if ((*field)[nx][ny] == '#' || (*last_use)[nx][ny] == UT || velocity.get(x, y, dx, dy) > 0) {
+                if (!cell.is_open(i) || (*last_use)[nx][ny] == UT || velocity.get(x, y, dx, dy) > 0) {
                     continue;
                 }
                 propagate_stop(nx, ny);
@@ -333,12 +1119,13 @@ class Fluid {
 
         /// Reads:
         ///     last_use, UT, velocity
-        V_TYPE move_prob(int x, int y) {
-            V_TYPE sum = 0;
+        V_COMPUTE_TYPE move_prob(int x, int y) {
+            V_COMPUTE_TYPE sum = 0;
+            auto cell = (*cells)[x][y];
             for (size_t i = 0; i < deltas.size(); ++i) {
                 auto [dx, dy] = deltas[i];
                 int nx = x + dx, ny = y + dy;
-                if ((*field)[nx][ny] == '#' || (*last_use)[nx][ny] == UT) {
+                if (!cell.is_open(i) || (*last_use)[nx][ny] == UT) {
                     continue;
                 }
                 auto v = velocity.get(x, y, dx, dy);
@@ -357,15 +1144,16 @@ class Fluid {
         /// TODO: inderect: propagate_move, propagate_stop, swap_with
         bool propagate_move(int x, int y, bool is_first) {
             (*last_use)[x][y] = UT - is_first;
+            auto cell = (*cells)[x][y];
             bool ret = false;
             int nx = -1, ny = -1;
             do {
-                std::array<V_TYPE, deltas.size()> tres;
-                V_TYPE sum = 0;
+                std::array<V_COMPUTE_TYPE, deltas.size()> tres;
+                V_COMPUTE_TYPE sum = 0;
                 for (size_t i = 0; i < deltas.size(); ++i) {
                     auto [dx, dy] = deltas[i];
                     int nx = x + dx, ny = y + dy;
-                    if ((*field)[nx][ny] == '#' || (*last_use)[nx][ny] == UT) {
+                    if (!cell.is_open(i) || (*last_use)[nx][ny] == UT) {
                         tres[i] = sum;
                         continue;
                     }
@@ -382,13 +1170,13 @@ class Fluid {
                     break;
                 }
 
-                V_TYPE p = Rnd::random01<V_TYPE>() * sum;
+                V_COMPUTE_TYPE p = rnd.random01<V_COMPUTE_TYPE>() * sum;
                 size_t d = std::ranges::upper_bound(tres, p) - tres.begin();
 
                 auto [dx, dy] = deltas[d];
                 nx = x + dx;
                 ny = y + dy;
-                assert(velocity.get(x, y, dx, dy) > 0 && (*field)[nx][ny] != '#' && (*last_use)[nx][ny] < UT);
+                assert(velocity.get(x, y, dx, dy) > 0 && cell.is_open(d) && (*last_use)[nx][ny] < UT);
 
                 ret = ((*last_use)[nx][ny] == UT - 1 || propagate_move(nx, ny, false));
             } while (!ret);
@@ -396,7 +1184,7 @@ class Fluid {
             for (size_t i = 0; i < deltas.size(); ++i) {
                 auto [dx, dy] = deltas[i];
                 int nx = x + dx, ny = y + dy;
-                if ((*field)[nx][ny] != '#' && (*last_use)[nx][ny] < UT - 1 && velocity.get(x, y, dx, dy) < 0) {
+                if (cell.is_open(i) && (*last_use)[nx][ny] < UT - 1 && velocity.get(x, y, dx, dy) < 0) {
                     propagate_stop(nx, ny);
                 }
             }
@@ -411,41 +1199,137 @@ class Fluid {
             return ret;
         }
 
+        /// Calls f(x, y) for all cells in row-major order on the calling
+        /// thread. Chunks of walls only are skipped, the order of the rest is
+        /// the same as for dense storage.
         template<typename F>
-        requires requires(const F& f, size_t x, size_t y) {
-            { f(x, y) } -> std::same_as<void>;
-        }
-        void forall(const F& f) {
-            for (size_t x_mod_3 = 0; x_mod_3 < 3; ++x_mod_3) {
-                for (size_t x = x_mod_3; x < n; ++x) {
-                    pool.add_task([this, &f, x]{
-                        for (size_t y = 0; y < m; ++y) {
-                            f(x, y);
+        void forall_serial(const F& f) {
+            for (size_t x = 0; x < n; ++x) {
+                for (size_t y = 0; y < m; ) {
+                    size_t y_end = m;
+                    if (chunks) {
+                        y_end = std::min(m, (y / ChunkMap::CHUNK + 1) * ChunkMap::CHUNK);
+                        if (!chunks->is_active(x / ChunkMap::CHUNK, y / ChunkMap::CHUNK)) {
+                            y = y_end;
+                            continue;
                         }
-                    });
+                    }
+                    for (; y < y_end; ++y) {
+                        f(x, y);
+                    }
                 }
-                pool.wait_all();
             }
         }
 
-        ThreadPool pool;
+        /// Opens counters for each thread of the pool and the calling one
+        void init_perf() {
+            perf = std::make_unique<PerfCounters>();
+            TaskGroup group(pool);
+            for (size_t i = 0; i < pool.threads_count(); ++i) {
+                group.add_task_for(i, [this] {
+                    perf->attach_current_thread();
+                });
+            }
+            group.wait();
+            perf->attach_current_thread();
+            phase_stats.counters_available = perf->get_available();
+        }
+
+        /// Runs f on the calling thread. With slabs only the leader runs it,
+        /// while the rest wait for it.
+        template<typename F>
+        void serial(const F& f) {
+            if (!options.slabs) {
+                f();
+                return;
+            }
+            if (options.slabs->is_leader()) {
+                f();
+            }
+            options.slabs->barrier();
+        }
+
+        /// Creates own pool, unless a shared one is given in options
+        ThreadPool& init_pool() {
+            if (options.pool != nullptr) {
+                return *options.pool;
+            }
+            own_pool = std::make_unique<ThreadPool>(options.threads, options.pinning);
+            return *own_pool;
+        }
+
+        /// Starts new last_use epoch: cells with last_use < UT - 1 are
+        /// considered unvisited. last_use is narrow, so instead of overflowing
+        /// UT is restarted, which requires rescan of the whole last_use.
+        /// Writes:
+        ///     UT, last_use
+        void next_epoch() {
+            if (advance_epoch(UT, last_use_t{2})) {
+                last_use->reset();
+            }
+        }
+
+        /// Zeroes velocity_flow in O(1), see LazyVectorField
+        /// Writes:
+        ///     velocity_flow
+        void reset_flow() {
+            if (velocity_flow.reset()) {
+                serial([this] {
+                    velocity_flow.clear_tags();
+                });
+            }
+        }
+
+        FluidOptions options;
+
+        std::unique_ptr<ThreadPool> own_pool = nullptr;
+        ThreadPool& pool;
+        std::unique_ptr<TileScheduler> scheduler = nullptr;
+
+        Rnd rnd;
+        size_t ticks_done = 0;
+        /// Is cleared, unless a tick has thrown
+        bool in_tick = false;
+
+        // Declared before the matrices, so that it outlives them
+        std::unique_ptr<Arena> arena = nullptr;
+        /// Start of the file of Storage::FILE
+        CheckpointHeader* header = nullptr;
 
         size_t n, m;
+        /// Active chunks of Storage::CHUNKED, null for dense storage
+        std::unique_ptr<ChunkMap> chunks = nullptr;
         std::unique_ptr<AbstractMatrix<char>> field = nullptr; // N x M + 1
 
-        P_TYPE rho[256];
+        /// Zero for characters, that are not in the scenario
+        P_COMPUTE_TYPE rho[256]{};
 
+        // Double buffer, see apply_p_forces
         std::unique_ptr<AbstractMatrix<P_TYPE>> p = nullptr; // N x M
         std::unique_ptr<AbstractMatrix<P_TYPE>> old_p = nullptr; // N x M
+        /// p is the matrix, that was created second, is saved in checkpoints
+        bool p_second = false;
 
         VectorField<V_TYPE> velocity;
-        VectorField<V_FLOW_TYPE> velocity_flow;
-        std::unique_ptr<AbstractMatrix<int>> last_use = nullptr; // N x M
-        int UT;
+        LazyVectorField<V_FLOW_TYPE, last_use_t> velocity_flow;
+        std::unique_ptr<AbstractMatrix<last_use_t>> last_use = nullptr; // N x M
+        last_use_t UT = 0;
+
+        V_COMPUTE_TYPE g;
+
+        std::unique_ptr<AbstractMatrix<CellInfo>> cells = nullptr; // N x M
 
-        V_TYPE g;
+        PhaseStats phase_stats;
+        std::unique_ptr<PerfCounters> perf = nullptr;
 
-        std::unique_ptr<AbstractMatrix<int>> dirs = nullptr; // N x M
+        SteadyCriteria steady_criteria;
+        SteadyState steady;
+        std::vector<double> tile_max_dp; // tiles count
+        std::vector<double> tile_energy; // tiles count
+        /// Movable cells of each tile in row-major order, see recalc_p
+        std::vector<std::vector<std::pair<size_t, size_t>>> tile_movable; // tiles count
+        /// All of tile_movable, is kept to reuse the memory
+        std::vector<std::pair<size_t, size_t>> movable_cells;
 
     friend ParticleParams<P_TYPE, V_TYPE>;
 };
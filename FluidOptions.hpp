@@ -0,0 +1,92 @@
+#pragma once
+
+#include "Memory.hpp"
+#include "Metrics.hpp"
+#include "Rnd.hpp"
+#include "Slabs.hpp"
+#include "ThreadPool.hpp"
+
+#include <cstddef>
+#include <string>
+
+/// Placement of grid storage on NUMA machines
+enum class NumaPolicy {
+    /// Storage is zeroed by the main thread
+    NONE,
+    /// Tiles are owned by threads, and each thread initializes storage of its
+    /// tiles, so pages land on its node
+    FIRST_TOUCH,
+    /// Pages are interleaved over all nodes
+    INTERLEAVE,
+};
+
+/// Backend of grid storage
+enum class Storage {
+    /// Full n x m matrices, see create_matrix
+    DENSE,
+    /// Only chunks with non-wall cells are stored, see ChunkedMatrix
+    CHUNKED,
+    /// Matrices are mapped from storage_file in tile order, so the grid may
+    /// be larger than RAM. The file is a checkpoint after the simulation is
+    /// destroyed or Fluid::checkpoint is called.
+    FILE,
+};
+
+/// Order of cells in Fluid::maybe_propagate
+enum class Propagate {
+    /// Row-major order of all cells, as without the list of movable cells:
+    /// the same draws of the random generator and the same results
+    EXACT,
+    /// Only movable cells in the order of tiles. Cells, that can not move,
+    /// are not stopped, so results differ, but do not depend on the order
+    /// of the rest of the grid.
+    FAST,
+};
+
+struct FluidOptions {
+    /// Run gravity and forces from p in one pass over the grid instead of
+    /// two, see Fluid::apply_forces_fused. Results are identical.
+    bool fuse_phases = true;
+
+    /// Size of tiles, that are processed by a single task. tile_m == 0 means
+    /// full-width tiles. See TileScheduler.
+    size_t tile_n = 4;
+    size_t tile_m = 0;
+
+    size_t threads = default_threads_count();
+    ThreadPinning pinning;
+
+    /// Pool to run on instead of an own pool of the simulation. Is shared by
+    /// simulations of a server, threads and pinning are ignored then. Must
+    /// outlive the simulation.
+    ThreadPool* pool = nullptr;
+
+    /// Group of processes, that share the simulation by slabs of rows,
+    /// must be launched before the simulation is created in each of them.
+    /// Requires dense storage. Must outlive the simulation.
+    SlabGroup* slabs = nullptr;
+
+    NumaPolicy numa = NumaPolicy::NONE;
+
+    Storage storage = Storage::DENSE;
+    std::string storage_file;
+
+    /// Carve all grid buffers out of a single huge-page backed Arena instead
+    /// of separate mappings
+    bool arena = false;
+    HugePages huge_pages = HugePages::MADVISE;
+
+    Propagate propagate = Propagate::EXACT;
+
+    /// Count hardware events of each phase, see PerfCounters and
+    /// PhaseStats::counters. Threads of a shared pool count other
+    /// simulations as well.
+    bool perf_counters = false;
+
+    /// Totals of phase stats are published there after each tick for the
+    /// exporter, see SimulationMetrics. Must outlive the simulation.
+    SimulationMetrics* metrics = nullptr;
+
+    /// Seed of the random generator of the simulation
+    Rnd::seed_type seed = Rnd::DEFAULT_SEED;
+};
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+/// State of the simulation, converted to double, e.g. to compare runs with
+/// different types
+struct FluidSnapshot {
+    size_t n = 0, m = 0;
+    /// Row-major, n * m
+    std::string field;
+    std::vector<double> p;
+    /// Centre of mass of each material: mean row of its cells, 0 if it has
+    /// none. Cells are only swapped, so the mass itself never changes, while
+    /// the centre drifts, as the material falls or rises.
+    std::array<double, 256> center{};
+};
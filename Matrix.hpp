@@ -1,12 +1,148 @@
 #pragma once
 
+#include "Memory.hpp"
+
+#include <algorithm>
 #include <array>
+#include <bit>
 #include <cassert>
 #include <cstddef>
+#include <cstdint>
 #include <iostream>
 #include <memory>
+#include <new>
+#include <numeric>
 #include <ostream>
 #include <type_traits>
+#include <vector>
+
+/// Rounds cells of cell_size bytes up to a whole number of cache lines.
+/// Layouts are given cell_size to pad ranges, that different threads write,
+/// so that they never share a line.
+constexpr size_t pad_to_cache_lines(size_t cells, size_t cell_size) {
+    size_t unit = Arena::CACHE_LINE / std::gcd(Arena::CACHE_LINE, cell_size);
+    return (cells + unit - 1) / unit * unit;
+}
+
+/// Row-major layout: cell (i, j) is stored at i * stride + j. The stride pads
+/// each row to whole cache lines, so threads, that own different rows, never
+/// write the same line.
+class RowMajorLayout {
+    public:
+        constexpr RowMajorLayout(size_t n, size_t m, size_t cell_size)
+          : n(n),
+            stride(pad_to_cache_lines(m, cell_size))
+        {}
+
+        constexpr size_t size() const {
+            return n * stride;
+        }
+
+        constexpr size_t index(size_t i, size_t j) const {
+            return i * stride + j;
+        }
+
+    private:
+        size_t n, stride;
+};
+
+/// Matrix is split into TILE x TILE blocks, that are stored one after another
+/// in row-major order. Cells inside a block are stored in row-major order too,
+/// so a vertical step stays inside the block most of the time. Blocks of less
+/// than a cache line are padded to a whole one.
+template<size_t TILE_>
+requires (std::has_single_bit(TILE_))
+class TiledLayout {
+    public:
+        static constexpr size_t TILE = TILE_;
+
+        constexpr TiledLayout(size_t n, size_t m, size_t cell_size)
+          : n_tiles((n + TILE - 1) / TILE),
+            m_tiles((m + TILE - 1) / TILE),
+            tile_cells(pad_to_cache_lines(TILE * TILE, cell_size))
+        {}
+
+        constexpr size_t size() const {
+            return n_tiles * m_tiles * tile_cells;
+        }
+
+        constexpr size_t index(size_t i, size_t j) const {
+            size_t tile = (i / TILE) * m_tiles + j / TILE;
+            return tile * tile_cells + (i % TILE) * TILE + j % TILE;
+        }
+
+    private:
+        size_t n_tiles, m_tiles;
+        size_t tile_cells;
+};
+
+/// Z-order (Morton) layout. Both sides are padded to powers of two, the low
+/// bits of i and j are interleaved and the remaining high bits of the longer
+/// side are put on top, so non-square matrices do not waste more than 4x.
+/// Aligned quadrants of 64 cells and more are whole cache lines already, so
+/// cell_size is not needed.
+class MortonLayout {
+    public:
+        constexpr MortonLayout(size_t n, size_t m, size_t /* cell_size */)
+          : n_bits(std::bit_width(n > 0 ? n - 1 : 0)),
+            m_bits(std::bit_width(m > 0 ? m - 1 : 0)),
+            common_bits(std::min(n_bits, m_bits))
+        {}
+
+        constexpr size_t size() const {
+            return size_t(1) << (n_bits + m_bits);
+        }
+
+        constexpr size_t index(size_t i, size_t j) const {
+            size_t low_mask = (size_t(1) << common_bits) - 1;
+            size_t high = (i >> common_bits) | (j >> common_bits);
+            return (high << (2 * common_bits))
+                | (spread_bits(i & low_mask) << 1)
+                | spread_bits(j & low_mask);
+        }
+
+    private:
+        /// Inserts zero bit after each bit of x: 0b111 -> 0b10101
+        static constexpr uint64_t spread_bits(uint64_t x) {
+            x &= 0xffffffff;
+            x = (x | (x << 16)) & 0x0000ffff0000ffff;
+            x = (x | (x << 8))  & 0x00ff00ff00ff00ff;
+            x = (x | (x << 4))  & 0x0f0f0f0f0f0f0f0f;
+            x = (x | (x << 2))  & 0x3333333333333333;
+            x = (x | (x << 1))  & 0x5555555555555555;
+            return x;
+        }
+
+        size_t n_bits, m_bits, common_bits;
+};
+
+#define ROW_MAJOR RowMajorLayout
+#define TILED(tile) TiledLayout<tile>
+#define MORTON MortonLayout
+
+/// Layout of all matrices, is selected per build
+using matrix_layout = LAYOUT;
+
+/// Layout of matrices with MatrixOptions::tile_ordered, regardless of LAYOUT
+using tile_ordered_layout = TiledLayout<64>;
+
+/// Proxy for a single matrix row, makes m[i][j] work for any layout
+template<typename M, typename T>
+class MatrixRow {
+    public:
+        MatrixRow(M& matrix, size_t i)
+          : matrix(matrix),
+            i(i)
+        {}
+
+        T& operator[](size_t j) const {
+            return matrix.at(i, j);
+        }
+
+    private:
+        M& matrix;
+        size_t i;
+};
 
 template<typename T>
 class AbstractMatrix {
@@ -27,7 +163,7 @@ class AbstractMatrix {
 
         virtual size_t get_m() const = 0;
 
-        void reset() {
+        virtual void reset() {
             for (size_t i = 0; i < get_n(); ++i) {
                 for (size_t j = 0; j < get_m(); ++j) {
                     (*this)[i][j] = T{};
@@ -35,8 +171,20 @@ class AbstractMatrix {
             }
         }
 
-        virtual T* operator[](size_t i) = 0;
-        virtual const T* operator[](size_t i) const = 0;
+        virtual T& at(size_t i, size_t j) = 0;
+        virtual const T& at(size_t i, size_t j) const = 0;
+
+        /// Hint about the use of cells [x_begin, x_end) x [y_begin, y_end),
+        /// see Access. Does nothing for matrices in regular memory.
+        virtual void advise(size_t /* x_begin */, size_t /* x_end */, size_t /* y_begin */, size_t /* y_end */, Access /* access */) const {}
+
+        MatrixRow<AbstractMatrix, T> operator[](size_t i) {
+            return {*this, i};
+        }
+
+        MatrixRow<const AbstractMatrix, const T> operator[](size_t i) const {
+            return {*this, i};
+        }
 };
 
 template<typename T>
@@ -70,33 +218,71 @@ class StaticMatix : public AbstractMatrix<T> {
             return M;
         }
 
-        T* operator[](size_t i) override {
-            return data.data() + i * M;
+        T& at(size_t i, size_t j) override {
+            return data[layout.index(i, j)];
         }
 
-        const T* operator[](size_t i) const override {
-            return data.data() + i * M;
+        const T& at(size_t i, size_t j) const override {
+            return data[layout.index(i, j)];
         }
 
     private:
-        std::array<T, N * M> data;
+        static constexpr matrix_layout layout{N, M, sizeof(T)};
+
+        std::array<T, layout.size()> data;
 };
 
-template<typename T>
+/// How memory of matrices is placed
+struct MatrixOptions {
+    /// Cells are not constructed by the matrix. The owner must construct each
+    /// cell with placement new before use, e.g. in parallel by the threads,
+    /// that will use them, so that pages land on their NUMA nodes.
+    bool deferred_init = false;
+
+    /// Spread pages over all NUMA nodes
+    bool numa_interleave = false;
+
+    /// Take memory from the arena instead of a separate mapping. The arena
+    /// must outlive the matrix.
+    Arena* arena = nullptr;
+
+    /// Use tile_ordered_layout, so that each 64 x 64 tile is a contiguous
+    /// range, e.g. to page tiles of a file mapping in and out as a whole
+    bool tile_ordered = false;
+
+    /// Static matrices are zeroed by the creating thread and live outside of
+    /// any arena, so they are not used, when memory placement matters
+    bool allows_static() const {
+        return !deferred_init && !numa_interleave && arena == nullptr && !tile_ordered;
+    }
+};
+
+template<typename T, typename Layout = matrix_layout>
 class DynamicMatrix : public AbstractMatrix<T> {
+    static_assert(std::is_trivially_destructible_v<T>);
+    static_assert(alignof(T) <= Arena::CACHE_LINE);
+
     public:
-        DynamicMatrix(size_t n, size_t m)
-          : data(new T[n * m]{}),
-            n(n),
-            m(m)
-        {}
+        DynamicMatrix(size_t n, size_t m, const MatrixOptions& options = {})
+          : n(n),
+            m(m),
+            layout(n, m, sizeof(T)),
+            buffer(options.arena ? 0 : bytes(n, m), options.numa_interleave),
+            data(static_cast<T*>(options.arena ? options.arena->allocate(bytes(n, m)) : buffer.data()))
+        {
+            if (!options.deferred_init) {
+                for (size_t i = 0; i < layout.size(); ++i) {
+                    new (data + i) T{};
+                }
+            }
+        }
 
-        T* operator[](size_t i) override {
-            return data.get() + i * m;
+        T& at(size_t i, size_t j) override {
+            return data[layout.index(i, j)];
         }
 
-        const T* operator[](size_t i) const override {
-            return data.get() + i * m;
+        const T& at(size_t i, size_t j) const override {
+            return data[layout.index(i, j)];
         }
 
         size_t get_n() const override {
@@ -107,9 +293,175 @@ class DynamicMatrix : public AbstractMatrix<T> {
             return m;
         }
 
+        /// Index is monotonic in both coordinates for all layouts, so the
+        /// corners bound the range. For a tile of the layout it is exact.
+        void advise(size_t x_begin, size_t x_end, size_t y_begin, size_t y_end, Access access) const override {
+            if (x_begin == x_end || y_begin == y_end) {
+                return;
+            }
+            size_t first = layout.index(x_begin, y_begin);
+            size_t last = layout.index(x_end - 1, y_end - 1);
+            ::advise(data + first, (last - first + 1) * sizeof(T), access);
+        }
+
+        /// Memory, taken by an n x m matrix
+        static size_t bytes(size_t n, size_t m) {
+            return Layout{n, m, sizeof(T)}.size() * sizeof(T);
+        }
+
     private:
-        size_t n, m;;
-        std::unique_ptr<T[]> data;
+        size_t n, m;
+        Layout layout;
+        PageBuffer buffer;
+        T* data;
+};
+
+/// Which CHUNK x CHUNK chunks of an n x m grid hold any non-wall cell.
+/// Active chunks are numbered in row-major order, the number is the slot of
+/// the chunk in the storage of ChunkedMatrix.
+class ChunkMap {
+    public:
+        static constexpr size_t CHUNK = 64;
+        static constexpr size_t NONE = SIZE_MAX;
+
+        /// is_open(i, j) is true for cells, that need real storage
+        template<typename F>
+        ChunkMap(size_t n, size_t m, const F& is_open)
+          : n(n),
+            m(m),
+            chunks_n((n + CHUNK - 1) / CHUNK),
+            chunks_m((m + CHUNK - 1) / CHUNK),
+            slots(chunks_n * chunks_m, NONE)
+        {
+            for (size_t i = 0; i < n; ++i) {
+                for (size_t j = 0; j < m; ++j) {
+                    auto& slot = slots[(i / CHUNK) * chunks_m + j / CHUNK];
+                    if (slot == NONE && is_open(i, j)) {
+                        // Numbered below
+                        slot = 0;
+                    }
+                }
+            }
+            for (auto& slot : slots) {
+                if (slot != NONE) {
+                    slot = active_count++;
+                }
+            }
+        }
+
+        size_t get_n() const {
+            return n;
+        }
+
+        size_t get_m() const {
+            return m;
+        }
+
+        size_t get_chunks_n() const {
+            return chunks_n;
+        }
+
+        size_t get_chunks_m() const {
+            return chunks_m;
+        }
+
+        size_t get_active_count() const {
+            return active_count;
+        }
+
+        /// Slot of chunk (ci, cj) or NONE for a chunk of walls only
+        size_t slot(size_t ci, size_t cj) const {
+            return slots[ci * chunks_m + cj];
+        }
+
+        bool is_active(size_t ci, size_t cj) const {
+            return slot(ci, cj) != NONE;
+        }
+
+    private:
+        size_t n, m;
+        size_t chunks_n, chunks_m;
+        size_t active_count = 0;
+        std::vector<size_t> slots;
+};
+
+/// Sparse matrix for maps, that are mostly walls: only active chunks of the
+/// map are stored, one after another. All other chunks share a single
+/// read-only sentinel chunk, that is filled with the value of a wall cell.
+///
+/// Memory is proportional to the area of the fluid instead of n * m. Cells of
+/// inactive chunks must never be written, so the owner skips such chunks
+/// (see TileScheduler), and reset only touches active chunks.
+template<typename T>
+class ChunkedMatrix : public AbstractMatrix<T> {
+    static_assert(std::is_trivially_destructible_v<T>);
+    static_assert(alignof(T) <= Arena::CACHE_LINE);
+
+    static constexpr size_t CHUNK = ChunkMap::CHUNK;
+    static constexpr size_t CHUNK_CELLS = CHUNK * CHUNK;
+
+    public:
+        /// map must cover the matrix, but may be created for a different
+        /// number of columns, e.g. for field with its extra column
+        ChunkedMatrix(const ChunkMap& map, const T& wall_value, const MatrixOptions& options = {})
+          : n(map.get_n()),
+            m(map.get_m()),
+            chunks_m(map.get_chunks_m()),
+            sentinel(std::make_unique<T[]>(CHUNK_CELLS)),
+            buffer(options.arena ? 0 : bytes(map), options.numa_interleave),
+            data(static_cast<T*>(options.arena ? options.arena->allocate(bytes(map)) : buffer.data())),
+            active_count(map.get_active_count()),
+            chunks(map.get_chunks_n() * chunks_m)
+        {
+            std::fill(sentinel.get(), sentinel.get() + CHUNK_CELLS, wall_value);
+            for (size_t ci = 0; ci < map.get_chunks_n(); ++ci) {
+                for (size_t cj = 0; cj < chunks_m; ++cj) {
+                    size_t slot = map.slot(ci, cj);
+                    chunks[ci * chunks_m + cj] = slot == ChunkMap::NONE ? sentinel.get() : data + slot * CHUNK_CELLS;
+                }
+            }
+            if (!options.deferred_init) {
+                // Active chunks may have walls too
+                for (size_t i = 0; i < active_count * CHUNK_CELLS; ++i) {
+                    new (data + i) T(wall_value);
+                }
+            }
+        }
+
+        T& at(size_t i, size_t j) override {
+            return chunks[(i / CHUNK) * chunks_m + j / CHUNK][(i % CHUNK) * CHUNK + j % CHUNK];
+        }
+
+        const T& at(size_t i, size_t j) const override {
+            return chunks[(i / CHUNK) * chunks_m + j / CHUNK][(i % CHUNK) * CHUNK + j % CHUNK];
+        }
+
+        size_t get_n() const override {
+            return n;
+        }
+
+        size_t get_m() const override {
+            return m;
+        }
+
+        void reset() override {
+            std::fill(data, data + active_count * CHUNK_CELLS, T{});
+        }
+
+        /// Memory, taken by active chunks of the map
+        static size_t bytes(const ChunkMap& map) {
+            return map.get_active_count() * CHUNK_CELLS * sizeof(T);
+        }
+
+    private:
+        size_t n, m;
+        size_t chunks_m;
+        std::unique_ptr<T[]> sentinel;
+        PageBuffer buffer;
+        T* data;
+        size_t active_count;
+        /// Chunk of each (ci, cj): either in data or the sentinel
+        std::vector<T*> chunks;
 };
 
 struct size_marker {
@@ -122,24 +474,27 @@ struct create_matrix_;
 
 template<typename T, size_marker SZ, size_marker... SZS>
 struct create_matrix_<T, SZ, SZS...> {
-    AbstractMatrix<T>* operator()(size_t n, size_t m) {
+    AbstractMatrix<T>* operator()(size_t n, size_t m, const MatrixOptions& options = {}) {
         constexpr auto N = SZ.n;
         constexpr auto M = SZ.m;
 
-        if (N == n && M == m) {
+        if (N == n && M == m && options.allows_static()) {
             std::cout << "Using StaticMatrix: N = " << N << ", M = " << M << std::endl;
             return new StaticMatix<T, N, M>(N, M);
         }
 
-        return create_matrix_<T, SZS...>{}(n, m);
+        return create_matrix_<T, SZS...>{}(n, m, options);
     }
 };
 
 template<typename T>
 struct create_matrix_<T> {
-    AbstractMatrix<T>* operator()(size_t n, size_t m) {
+    AbstractMatrix<T>* operator()(size_t n, size_t m, const MatrixOptions& options = {}) {
         std::cout << "Using DynamicMatrix: N = " << n << ", M = " << m << std::endl;
-        return new DynamicMatrix<T>(n, m);
+        if (options.tile_ordered) {
+            return new DynamicMatrix<T, tile_ordered_layout>(n, m, options);
+        }
+        return new DynamicMatrix<T>(n, m, options);
     }
 };
 
@@ -0,0 +1,242 @@
+#include "Memory.hpp"
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <new>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace {
+    // From <numaif.h>, which is not always installed
+    constexpr int MPOL_INTERLEAVE_ = 3;
+
+    constexpr size_t HUGE_PAGE = 2 << 20;
+
+    size_t round_up(size_t bytes, size_t alignment) {
+        return (bytes + alignment - 1) / alignment * alignment;
+    }
+
+    /// Parses /sys/devices/system/node/online, e.g. "0-1,3"
+    std::vector<unsigned long> online_nodes_mask() {
+        std::ifstream fin("/sys/devices/system/node/online");
+        std::string list;
+        if (!(fin >> list)) {
+            return {};
+        }
+
+        std::vector<unsigned long> mask;
+        auto set = [&mask](size_t node) {
+            constexpr size_t bits = sizeof(unsigned long) * 8;
+            if (mask.size() <= node / bits) {
+                mask.resize(node / bits + 1);
+            }
+            mask[node / bits] |= 1ul << (node % bits);
+        };
+
+        std::stringstream ss(list);
+        std::string range;
+        while (std::getline(ss, range, ',')) {
+            auto dash = range.find('-');
+            size_t first = std::stoul(range.substr(0, dash));
+            size_t last = dash == std::string::npos ? first : std::stoul(range.substr(dash + 1));
+            for (size_t node = first; node <= last; ++node) {
+                set(node);
+            }
+        }
+        return mask;
+    }
+}
+
+PageBuffer::PageBuffer(size_t bytes, bool interleave, HugePages huge_pages)
+  : bytes(bytes)
+{
+    if (bytes == 0) {
+        return;
+    }
+    if (huge_pages != HugePages::NONE) {
+        map_huge(huge_pages);
+    } else {
+        ptr = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (ptr == MAP_FAILED) {
+            ptr = nullptr;
+            throw std::bad_alloc();
+        }
+    }
+
+    if (interleave && !numa_interleave(ptr, bytes)) {
+        static bool warned = false;
+        if (!warned) {
+            warned = true;
+            std::cerr << "NUMA interleave is not available, using default policy" << std::endl;
+        }
+    }
+}
+
+void PageBuffer::map_huge(HugePages huge_pages) {
+    bytes = round_up(bytes, HUGE_PAGE);
+
+    if (huge_pages == HugePages::HUGETLB) {
+        ptr = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (ptr != MAP_FAILED) {
+            return;
+        }
+        ptr = nullptr;
+        std::cerr << "MAP_HUGETLB failed, falling back to transparent huge pages" << std::endl;
+    }
+
+    // Map one huge page more and trim both ends to get an aligned range
+    size_t mapped = bytes + HUGE_PAGE;
+    void* raw = mmap(nullptr, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (raw == MAP_FAILED) {
+        throw std::bad_alloc();
+    }
+    auto begin = reinterpret_cast<uintptr_t>(raw);
+    auto aligned = round_up(begin, HUGE_PAGE);
+    if (aligned > begin) {
+        munmap(raw, aligned - begin);
+    }
+    if (begin + mapped > aligned + bytes) {
+        munmap(reinterpret_cast<void*>(aligned + bytes), begin + mapped - aligned - bytes);
+    }
+    ptr = reinterpret_cast<void*>(aligned);
+
+#ifdef MADV_HUGEPAGE
+    // Only a hint: THP may be disabled
+    madvise(ptr, bytes, MADV_HUGEPAGE);
+#endif
+}
+
+PageBuffer PageBuffer::map_file(const std::string& path, size_t bytes, bool create) {
+    int fd = open(path.c_str(), O_RDWR | O_CLOEXEC | (create ? O_CREAT | O_TRUNC : 0), 0644);
+    if (fd < 0) {
+        throw std::runtime_error("failed to open " + path + ": " + std::strerror(errno));
+    }
+    return map_fd(fd, path, bytes, create);
+}
+
+PageBuffer PageBuffer::map_shm(const std::string& name, size_t bytes, bool create) {
+    int fd = shm_open(name.c_str(), O_RDWR | O_CLOEXEC | (create ? O_CREAT | O_EXCL : 0), 0600);
+    if (fd < 0) {
+        throw std::runtime_error("failed to open shared memory " + name + ": " + std::strerror(errno));
+    }
+    return map_fd(fd, name, bytes, create);
+}
+
+PageBuffer PageBuffer::map_fd(int fd, const std::string& path, size_t bytes, bool create) {
+    struct stat st;
+    bool ok = true;
+    if (create) {
+        ok = ftruncate(fd, bytes) == 0;
+    } else {
+        ok = fstat(fd, &st) == 0 && (size_t) st.st_size == bytes;
+    }
+    if (!ok) {
+        close(fd);
+        throw std::runtime_error("failed to " + std::string(create ? "resize " : "map ") + path);
+    }
+
+    PageBuffer ans;
+    ans.bytes = bytes;
+    ans.ptr = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    // The mapping keeps the file open
+    close(fd);
+    if (ans.ptr == MAP_FAILED) {
+        ans.ptr = nullptr;
+        ans.bytes = 0;
+        throw std::runtime_error("failed to map " + path);
+    }
+    return ans;
+}
+
+void PageBuffer::sync(const void* begin, size_t bytes) const {
+    size_t page = sysconf(_SC_PAGESIZE);
+    auto first = reinterpret_cast<uintptr_t>(begin) / page * page;
+    auto last = reinterpret_cast<uintptr_t>(begin) + bytes;
+    if (msync(reinterpret_cast<void*>(first), last - first, MS_SYNC) != 0) {
+        throw std::runtime_error(std::string("msync failed: ") + std::strerror(errno));
+    }
+}
+
+PageBuffer::PageBuffer(PageBuffer&& other)
+  : ptr(std::exchange(other.ptr, nullptr)),
+    bytes(std::exchange(other.bytes, 0))
+{}
+
+PageBuffer& PageBuffer::operator=(PageBuffer&& other) {
+    std::swap(ptr, other.ptr);
+    std::swap(bytes, other.bytes);
+    return *this;
+}
+
+PageBuffer::~PageBuffer() {
+    if (ptr != nullptr) {
+        munmap(ptr, bytes);
+    }
+}
+
+void* Arena::allocate(size_t bytes) {
+    size_t size = slice_size(bytes);
+    if (size > buffer.size() - offset) {
+        throw std::bad_alloc();
+    }
+    void* ans = static_cast<char*>(buffer.data()) + offset;
+    offset += size;
+    return ans;
+}
+
+void advise(const void* ptr, size_t bytes, Access access) {
+    int advice = -1;
+    switch (access) {
+        case Access::WILL_NEED:
+            advice = MADV_WILLNEED;
+            break;
+        case Access::COLD:
+#ifdef MADV_COLD
+            advice = MADV_COLD;
+#endif
+            break;
+    }
+    if (advice < 0 || bytes == 0) {
+        return;
+    }
+
+    size_t page = sysconf(_SC_PAGESIZE);
+    auto begin = reinterpret_cast<uintptr_t>(ptr) / page * page;
+    auto end = reinterpret_cast<uintptr_t>(ptr) + bytes;
+    // Only a hint: errors are ignored
+    madvise(reinterpret_cast<void*>(begin), end - begin, advice);
+}
+
+bool numa_interleave(void* ptr, size_t bytes) {
+    auto mask = online_nodes_mask();
+    if (mask.empty() || (mask.size() == 1 && (mask[0] & (mask[0] - 1)) == 0)) {
+        // Zero or one node
+        return false;
+    }
+
+    size_t page = sysconf(_SC_PAGESIZE);
+    auto begin = reinterpret_cast<uintptr_t>(ptr) / page * page;
+    auto end = reinterpret_cast<uintptr_t>(ptr) + bytes;
+    long ret = syscall(
+        SYS_mbind,
+        begin,
+        end - begin,
+        MPOL_INTERLEAVE_,
+        mask.data(),
+        mask.size() * sizeof(unsigned long) * 8 + 1,
+        0
+    );
+    return ret == 0;
+}
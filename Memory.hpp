@@ -0,0 +1,135 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <utility>
+
+/// How a mapping is backed by huge pages
+enum class HugePages {
+    /// Regular pages
+    NONE,
+    /// 2 MB-aligned mapping with madvise(MADV_HUGEPAGE), transparent huge
+    /// pages are used, when the kernel allows
+    MADVISE,
+    /// Explicit huge pages (MAP_HUGETLB) from the preallocated pool. Falls
+    /// back to MADVISE, if the pool is too small.
+    HUGETLB,
+};
+
+/// Hint about the upcoming use of a range of memory
+enum class Access {
+    /// Will be used soon, read ahead
+    WILL_NEED,
+    /// Is not needed for a while, may be paged out first
+    COLD,
+};
+
+/// Passes the hint to madvise, the range is extended to whole pages. Is a
+/// no-op, where the hint is not supported.
+void advise(const void* ptr, size_t bytes, Access access);
+
+/// Anonymous memory mapping. Pages are not backed by physical memory until
+/// the first touch, so each page lands on the NUMA node of the thread, that
+/// writes it first.
+class PageBuffer {
+    public:
+        PageBuffer() = default;
+
+        /// If interleave is set, pages are spread over all NUMA nodes
+        /// instead (where supported)
+        PageBuffer(size_t bytes, bool interleave = false, HugePages huge_pages = HugePages::NONE);
+
+        /// Shared mapping of a file, changes go to the file. If create is
+        /// set, the file is created or truncated to bytes, otherwise it must
+        /// already be of this size.
+        static PageBuffer map_file(const std::string& path, size_t bytes, bool create);
+
+        /// Shared mapping of a POSIX shared memory object (shm_open), that
+        /// other processes can map by its name
+        static PageBuffer map_shm(const std::string& name, size_t bytes, bool create);
+
+        PageBuffer(const PageBuffer&) = delete;
+        PageBuffer& operator=(const PageBuffer&) = delete;
+
+        PageBuffer(PageBuffer&& other);
+        PageBuffer& operator=(PageBuffer&& other);
+
+        ~PageBuffer();
+
+        void* data() const {
+            return ptr;
+        }
+
+        size_t size() const {
+            return bytes;
+        }
+
+        /// Writes the range of a file mapping back to the file, throws on
+        /// failure
+        void sync(const void* begin, size_t bytes) const;
+
+        void sync() const {
+            sync(ptr, bytes);
+        }
+
+    private:
+        void* ptr = nullptr;
+        size_t bytes = 0;
+
+        void map_huge(HugePages huge_pages);
+
+        /// Maps the whole of fd and closes it
+        static PageBuffer map_fd(int fd, const std::string& path, size_t bytes, bool create);
+};
+
+/// Bump allocator over a single PageBuffer, that holds all simulation buffers,
+/// so they share a few huge pages instead of many small ones.
+///
+/// Each slice starts at a cache line and is followed by a spare cache line, so
+/// that threads, writing the tail of one buffer and the head of the next one,
+/// do not share lines (with adjacent-line prefetch as well).
+/// Memory is released only with the whole arena.
+class Arena {
+    public:
+        static constexpr size_t CACHE_LINE = 64;
+
+        /// Bytes of the arena, taken by a slice of the given size
+        static constexpr size_t slice_size(size_t bytes) {
+            return (bytes + CACHE_LINE - 1) / CACHE_LINE * CACHE_LINE + CACHE_LINE;
+        }
+
+        Arena(size_t capacity, bool interleave = false, HugePages huge_pages = HugePages::MADVISE)
+          : buffer(capacity, interleave, huge_pages)
+        {}
+
+        /// Arena over an existing buffer, e.g. a file mapping. Slices are
+        /// taken in the same order each time, so the same sequence of
+        /// allocations finds the same data in a file.
+        explicit Arena(PageBuffer buffer)
+          : buffer(std::move(buffer))
+        {}
+
+        /// Returns cache line aligned memory, throws std::bad_alloc, if the
+        /// arena is exhausted
+        void* allocate(size_t bytes);
+
+        size_t used() const {
+            return offset;
+        }
+
+        size_t capacity() const {
+            return buffer.size();
+        }
+
+        const PageBuffer& get_buffer() const {
+            return buffer;
+        }
+
+    private:
+        PageBuffer buffer;
+        size_t offset = 0;
+};
+
+/// Sets interleave memory policy over all online NUMA nodes for the range.
+/// Returns false, if it is not supported (e.g. single node or no mbind).
+bool numa_interleave(void* ptr, size_t bytes);
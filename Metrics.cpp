@@ -0,0 +1,140 @@
+#include "Metrics.hpp"
+
+#include "ThreadPool.hpp"
+
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <ostream>
+#include <stdexcept>
+#include <utility>
+
+#include <unistd.h>
+
+void SimulationMetrics::publish(const PhaseStats& stats) {
+    ticks.store(stats.ticks, std::memory_order_relaxed);
+    for (size_t phase = 0; phase < PHASES_COUNT; ++phase) {
+        phase_seconds[phase].store(stats.time[phase].count(), std::memory_order_relaxed);
+    }
+    flow_sweeps.store(stats.flow_sweeps, std::memory_order_relaxed);
+    moves.store(stats.moves, std::memory_order_relaxed);
+}
+
+size_t resident_memory_bytes() {
+    // Sizes in pages: total, then resident
+    std::ifstream fin("/proc/self/statm");
+    size_t total = 0, resident = 0;
+    if (!(fin >> total >> resident)) {
+        return 0;
+    }
+    return resident * sysconf(_SC_PAGESIZE);
+}
+
+MetricsWriter::MetricsWriter(const SimulationMetrics& metrics, const ThreadPool* pool)
+  : metrics(metrics),
+    pool(pool),
+    last_time(clock::now())
+{}
+
+void MetricsWriter::write(std::ostream& out) {
+    auto now = clock::now();
+    uint64_t ticks = metrics.ticks.load(std::memory_order_relaxed);
+    uint64_t moves = metrics.moves.load(std::memory_order_relaxed);
+    double seconds = std::chrono::duration<double>(now - last_time).count();
+    double ticks_per_second = seconds > 0 ? (ticks - last_ticks) / seconds : 0;
+    double moves_per_tick = ticks > last_ticks ? double(moves - last_moves) / (ticks - last_ticks) : 0;
+    last_time = now;
+    last_ticks = ticks;
+    last_moves = moves;
+
+    auto family = [&out](const char* name, const char* type, const char* help) {
+        out << "# TYPE " << name << " " << type << "\n"
+            << "# HELP " << name << " " << help << "\n";
+    };
+
+    family("fluid_ticks", "counter", "Ticks made.");
+    out << "fluid_ticks_total " << ticks << "\n";
+    family("fluid_ticks_per_second", "gauge", "Ticks per second since the previous sample.");
+    out << "fluid_ticks_per_second " << ticks_per_second << "\n";
+
+    family("fluid_phase_seconds", "counter", "Wall-clock time of phases of ticks.");
+    for (size_t phase = 0; phase < PHASES_COUNT; ++phase) {
+        out << "fluid_phase_seconds_total{phase=\"" << phase_names[phase] << "\"} "
+            << metrics.phase_seconds[phase].load(std::memory_order_relaxed) << "\n";
+    }
+
+    family("fluid_flow_sweeps", "counter", "Passes of recalc_flow over the grid.");
+    out << "fluid_flow_sweeps_total " << metrics.flow_sweeps.load(std::memory_order_relaxed) << "\n";
+    family("fluid_moves", "counter", "Chains of moves started by propagation.");
+    out << "fluid_moves_total " << moves << "\n";
+    family("fluid_moves_per_tick", "gauge", "Chains of moves per tick since the previous sample.");
+    out << "fluid_moves_per_tick " << moves_per_tick << "\n";
+
+    if (pool != nullptr) {
+        family("fluid_pool_queue_depth", "gauge", "Tasks waiting for a thread of the pool.");
+        out << "fluid_pool_queue_depth " << pool->queue_depth() << "\n";
+        family("fluid_pool_idle_seconds", "counter", "Time threads of the pool waited for tasks.");
+        for (size_t i = 0; i < pool->threads_count(); ++i) {
+            out << "fluid_pool_idle_seconds_total{thread=\"" << i << "\"} " << pool->idle_time(i).count() << "\n";
+        }
+        family("fluid_pool_tasks", "counter", "Tasks run by threads of the pool.");
+        for (size_t i = 0; i < pool->threads_count(); ++i) {
+            out << "fluid_pool_tasks_total{thread=\"" << i << "\"} " << pool->tasks_done(i) << "\n";
+        }
+    }
+
+    family("process_resident_memory_bytes", "gauge", "Resident memory size in bytes.");
+    out << "process_resident_memory_bytes " << resident_memory_bytes() << "\n";
+    out << "# EOF\n";
+}
+
+MetricsExporter::MetricsExporter(
+    std::string path,
+    std::chrono::duration<double> interval,
+    const SimulationMetrics& metrics,
+    const ThreadPool* pool
+)
+  : path(std::move(path)),
+    interval(interval),
+    writer(metrics, pool)
+{
+    if (interval.count() <= 0) {
+        throw std::runtime_error("interval of metrics should be positive");
+    }
+    thread = std::thread(&MetricsExporter::run, this);
+}
+
+MetricsExporter::~MetricsExporter() {
+    {
+        std::lock_guard lock(mtx);
+        need_to_stop = true;
+    }
+    stop_cv.notify_all();
+    thread.join();
+    export_sample();
+}
+
+void MetricsExporter::run() {
+    std::unique_lock lock(mtx);
+    while (!stop_cv.wait_for(lock, interval, [this] { return need_to_stop; })) {
+        export_sample();
+    }
+}
+
+void MetricsExporter::export_sample() {
+    auto tmp_path = path + ".tmp";
+    {
+        std::ofstream fout(tmp_path);
+        writer.write(fout);
+        if (fout.flush()) {
+            if (std::rename(tmp_path.c_str(), path.c_str()) == 0) {
+                return;
+            }
+        }
+    }
+    std::remove(tmp_path.c_str());
+    if (!failed) {
+        std::cerr << "Failed to write metrics to " << path << std::endl;
+        failed = true;
+    }
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include "PhaseStats.hpp"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <iosfwd>
+#include <mutex>
+#include <string>
+#include <thread>
+
+class ThreadPool;
+
+/// Totals of a simulation for monitoring. The thread, that drives the
+/// simulation, is the only writer and publishes them once per tick, the
+/// exporter reads them concurrently. Fields are relaxed atomics: a single
+/// writer needs neither locks nor read-modify-write, so the tick pays for a
+/// few plain stores.
+struct SimulationMetrics {
+    std::atomic<uint64_t> ticks = 0;
+    std::array<std::atomic<double>, PHASES_COUNT> phase_seconds{};
+    std::atomic<uint64_t> flow_sweeps = 0;
+    std::atomic<uint64_t> moves = 0;
+
+    void publish(const PhaseStats& stats);
+};
+
+/// Resident set size of the process, 0 if unknown
+size_t resident_memory_bytes();
+
+/// Writes metrics in the OpenMetrics text format. Rates (ticks per second
+/// and moves per tick) are over the interval since the previous sample.
+/// pool may be null.
+class MetricsWriter {
+    public:
+        MetricsWriter(const SimulationMetrics& metrics, const ThreadPool* pool);
+
+        void write(std::ostream& out);
+
+    private:
+        using clock = std::chrono::steady_clock;
+
+        const SimulationMetrics& metrics;
+        const ThreadPool* pool;
+
+        clock::time_point last_time;
+        uint64_t last_ticks = 0;
+        uint64_t last_moves = 0;
+};
+
+/// Rewrites the file of metrics every interval from a background thread.
+/// Each sample is written to a temporary file next to path and renamed over
+/// it, so readers never see a partial file. The last sample is written on
+/// destruction, which must precede destruction of the simulation and the
+/// pool.
+class MetricsExporter {
+    public:
+        MetricsExporter(
+            std::string path,
+            std::chrono::duration<double> interval,
+            const SimulationMetrics& metrics,
+            const ThreadPool* pool
+        );
+
+        MetricsExporter(const MetricsExporter&) = delete;
+        MetricsExporter& operator=(const MetricsExporter&) = delete;
+
+        ~MetricsExporter();
+
+    private:
+        void run();
+
+        /// Errors are reported once, the simulation goes on
+        void export_sample();
+
+        std::string path;
+        std::chrono::duration<double> interval;
+        MetricsWriter writer;
+        bool failed = false;
+
+        std::mutex mtx;
+        std::condition_variable stop_cv;
+        bool need_to_stop = false;
+        std::thread thread;
+};
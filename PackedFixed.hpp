@@ -0,0 +1,148 @@
+#pragma once
+
+#include "Fixed.hpp"
+#include "FixedInner.hpp"
+
+#include <cmath>
+#include <cstdint>
+#include <istream>
+#include <limits>
+#include <ostream>
+
+/// Fixed point number, that is only stored in N bits. All arithmetic is done
+/// in wide_type: a 32-bit FixedInner with (32 - N) / 2 extra fractional bits,
+/// the rest of the spare bits is headroom for intermediate values.
+///
+/// Widening is exact. When values are stored back, they are rounded down, as
+/// in FixedInner conversions (flow propagation relies on a stored flow never
+/// exceeding the velocity it was computed from), and saturated instead of
+/// wrapping around.
+///
+/// Is meant for grids: matrices of PackedFixed<16, K> take half the memory
+/// of Fixed<32, K> (and a quarter of FastFixed<16, K> on x86-64), while
+/// kernels still compute in native registers.
+template<size_t N, size_t K>
+requires (N <= 32 && K < N)
+struct PackedFixed {
+    using type = typename intX_t<N>::type;
+    static constexpr size_t k = K;
+
+    static constexpr size_t EXTRA_BITS = (32 - N) / 2;
+    using wide_type = FixedInner<int32_t, K + EXTRA_BITS>;
+
+    constexpr PackedFixed(): v(0) {}
+    constexpr PackedFixed(int x): v(saturate((int64_t) x << K)) {}
+    constexpr PackedFixed(float f): PackedFixed((double) f) {}
+    constexpr PackedFixed(double f): v(saturate((int64_t) std::floor(f * ((int64_t) 1 << K)))) {}
+
+    template<typename T2, size_t K2>
+    constexpr PackedFixed(const FixedInner<T2, K2>& other) {
+        int64_t raw = other.v;
+        if constexpr (K2 > K) {
+            raw >>= K2 - K;
+        } else if constexpr (K2 < K) {
+            raw <<= K - K2;
+        }
+        v = saturate(raw);
+    }
+
+    template<size_t N2, size_t K2>
+    constexpr PackedFixed(const PackedFixed<N2, K2>& other)
+      : PackedFixed(other.widen())
+    {}
+
+    constexpr wide_type widen() const {
+        return wide_type::from_raw((int32_t) v << EXTRA_BITS);
+    }
+
+    constexpr explicit operator double() const { return (double) v / ((int64_t) 1 << K); }
+    constexpr explicit operator float() const { return (float) (double) *this; }
+
+    static constexpr PackedFixed from_raw(type x) {
+        PackedFixed ret;
+        ret.v = x;
+        return ret;
+    }
+
+    type v;
+
+    private:
+        static constexpr type saturate(int64_t raw) {
+            if (raw > std::numeric_limits<type>::max()) {
+                return std::numeric_limits<type>::max();
+            }
+            if (raw < std::numeric_limits<type>::min()) {
+                return std::numeric_limits<type>::min();
+            }
+            return raw;
+        }
+};
+
+template<size_t N, size_t K>
+struct IsPackedFixed<PackedFixed<N, K>> {
+    static constexpr bool value = true;
+};
+
+template<size_t N, size_t K>
+struct ComputeType<PackedFixed<N, K>> {
+    using type = typename PackedFixed<N, K>::wide_type;
+};
+
+template<size_t N, size_t K, typename U>
+struct CommonTypeFixed<PackedFixed<N, K>, U> {
+    using type = typename CommonTypeFixed<
+        typename PackedFixed<N, K>::wide_type,
+        typename ComputeType<U>::type
+    >::type;
+};
+
+template<typename U, size_t N, size_t K>
+requires (!IsPackedFixed<U>::value)
+struct CommonTypeFixed<U, PackedFixed<N, K>> {
+    using type = typename CommonTypeFixed<
+        U,
+        typename PackedFixed<N, K>::wide_type
+    >::type;
+};
+
+template<typename T1, typename T2>
+requires IsPackedFixed<T1>::value
+T1& operator+=(T1& lhs, T2 rhs) {
+    return lhs = T1(lhs + rhs);
+}
+
+template<typename T1, typename T2>
+requires IsPackedFixed<T1>::value
+T1& operator-=(T1& lhs, T2 rhs) {
+    return lhs = T1(lhs - rhs);
+}
+
+template<typename T1, typename T2>
+requires IsPackedFixed<T1>::value
+T1& operator*=(T1& lhs, T2 rhs) {
+    return lhs = T1(lhs * rhs);
+}
+
+template<typename T1, typename T2>
+requires IsPackedFixed<T1>::value
+T1& operator/=(T1& lhs, T2 rhs) {
+    return lhs = T1(lhs / rhs);
+}
+
+template<size_t N, size_t K>
+typename PackedFixed<N, K>::wide_type operator-(PackedFixed<N, K> x) {
+    return -x.widen();
+}
+
+template<size_t N, size_t K>
+std::ostream& operator<<(std::ostream& out, PackedFixed<N, K> x) {
+    return out << (double) x;
+}
+
+template<size_t N, size_t K>
+std::istream& operator>>(std::istream& in, PackedFixed<N, K>& x) {
+    double v;
+    in >> v;
+    x = PackedFixed<N, K>(v);
+    return in;
+}
@@ -0,0 +1,163 @@
+#include "PerfCounters.hpp"
+
+#include "PhaseStats.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <iomanip>
+#include <ostream>
+
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace {
+    /// Type and config of perf_event_attr for each Counter
+    struct EventConfig {
+        uint32_t type;
+        uint64_t config;
+    };
+
+    constexpr uint64_t cache_miss(uint64_t cache) {
+        return cache
+            | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+            | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    }
+
+    constexpr std::array<EventConfig, COUNTERS_COUNT> event_configs{{
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+        {PERF_TYPE_HW_CACHE, cache_miss(PERF_COUNT_HW_CACHE_L1D)},
+        {PERF_TYPE_HW_CACHE, cache_miss(PERF_COUNT_HW_CACHE_LL)},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+        {PERF_TYPE_HW_CACHE, cache_miss(PERF_COUNT_HW_CACHE_DTLB)},
+    }};
+
+    /// Layout of read with PERF_FORMAT_TOTAL_TIME_ENABLED and _RUNNING
+    struct ReadFormat {
+        uint64_t value;
+        uint64_t time_enabled;
+        uint64_t time_running;
+    };
+
+    int open_counter(const EventConfig& event) {
+        perf_event_attr attr;
+        std::memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = event.type;
+        attr.config = event.config;
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        // The calling thread on any CPU
+        return syscall(SYS_perf_event_open, &attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC);
+    }
+}
+
+PerfCounters::~PerfCounters() {
+    for (const auto& thread_fds : fds) {
+        for (int fd : thread_fds) {
+            if (fd >= 0) {
+                close(fd);
+            }
+        }
+    }
+}
+
+void PerfCounters::attach_current_thread() {
+    std::array<int, COUNTERS_COUNT> thread_fds;
+    for (size_t i = 0; i < COUNTERS_COUNT; ++i) {
+        thread_fds[i] = open_counter(event_configs[i]);
+    }
+
+    std::lock_guard lock(mtx);
+    for (size_t i = 0; i < COUNTERS_COUNT; ++i) {
+        available[i] = available[i] || thread_fds[i] >= 0;
+    }
+    fds.push_back(thread_fds);
+}
+
+CounterValues PerfCounters::read() const {
+    std::lock_guard lock(mtx);
+    CounterValues ans{};
+    for (const auto& thread_fds : fds) {
+        for (size_t i = 0; i < COUNTERS_COUNT; ++i) {
+            ReadFormat data;
+            if (thread_fds[i] < 0 || ::read(thread_fds[i], &data, sizeof(data)) != sizeof(data)) {
+                continue;
+            }
+            if (data.time_running == 0) {
+                continue;
+            }
+            ans[i] += (double) data.value * data.time_enabled / data.time_running;
+        }
+    }
+    return ans;
+}
+
+void print_counters(std::ostream& out, const PhaseStats& stats) {
+    bool any = false;
+    for (bool available : stats.counters_available) {
+        any = any || available;
+    }
+    if (!any) {
+        out << "\nHardware counters are not available" << std::endl;
+        return;
+    }
+
+    constexpr int WIDTH = 15;
+    auto available = [&stats](Counter counter) {
+        return stats.counters_available[(size_t) counter];
+    };
+
+    out << "\nHardware counters per tick (all threads):\n" << std::left << std::setw(13) << "phase";
+    for (auto name : counter_names) {
+        out << std::setw(WIDTH) << name;
+    }
+    out << "ipc\n";
+
+    size_t ticks = std::max<size_t>(stats.ticks, 1);
+    for (size_t phase = 0; phase < PHASES_COUNT; ++phase) {
+        const auto& values = stats.counters[phase];
+        out << std::setw(13) << phase_names[phase] << std::fixed << std::setprecision(0);
+        for (size_t i = 0; i < COUNTERS_COUNT; ++i) {
+            if (available((Counter) i)) {
+                out << std::setw(WIDTH) << values[i] / ticks;
+            } else {
+                out << std::setw(WIDTH) << "n/a";
+            }
+        }
+        double cycles = values[(size_t) Counter::CYCLES];
+        if (available(Counter::CYCLES) && available(Counter::INSTRUCTIONS) && cycles > 0) {
+            out << std::setprecision(2) << values[(size_t) Counter::INSTRUCTIONS] / cycles;
+        } else {
+            out << "n/a";
+        }
+        out << "\n";
+        out.unsetf(std::ios::floatfield);
+        out << std::setprecision(6);
+    }
+    out << std::right << std::flush;
+}
+
+void write_counters_json(std::ostream& out, const PhaseStats& stats) {
+    out << "{\"ticks\": " << stats.ticks << ", \"phases\": {";
+    out << std::fixed << std::setprecision(0);
+    for (size_t phase = 0; phase < PHASES_COUNT; ++phase) {
+        out << (phase > 0 ? ", " : "") << "\"" << phase_names[phase] << "\": {";
+        out << "\"seconds\": " << std::setprecision(9) << stats.time[phase].count() << std::setprecision(0);
+        for (size_t i = 0; i < COUNTERS_COUNT; ++i) {
+            out << ", \"" << counter_names[i] << "\": ";
+            if (stats.counters_available[i]) {
+                out << stats.counters[phase][i];
+            } else {
+                out << "null";
+            }
+        }
+        out << "}";
+    }
+    out << "}}\n";
+    out.unsetf(std::ios::floatfield);
+    out << std::setprecision(6) << std::flush;
+}
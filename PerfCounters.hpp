@@ -0,0 +1,80 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <iosfwd>
+#include <mutex>
+#include <string_view>
+#include <vector>
+
+/// Hardware events, that are counted per phase
+enum class Counter {
+    CYCLES,
+    INSTRUCTIONS,
+    L1D_MISSES,
+    LLC_MISSES,
+    BRANCH_MISSES,
+    DTLB_MISSES,
+};
+
+constexpr size_t COUNTERS_COUNT = 6;
+
+constexpr std::array<std::string_view, COUNTERS_COUNT> counter_names{
+    "cycles",
+    "instructions",
+    "l1d_misses",
+    "llc_misses",
+    "branch_misses",
+    "dtlb_misses",
+};
+
+using CounterValues = std::array<double, COUNTERS_COUNT>;
+
+struct PhaseStats;
+
+/// Hardware counters (perf_event_open) of a set of threads, e.g. the pool of
+/// a simulation and the thread, that drives it. Each thread opens its own
+/// counters, read sums them over all threads, so a phase is measured by the
+/// difference of two reads.
+///
+/// Counters, that can not be opened (no PMU in a container, restrictive
+/// perf_event_paranoid and so on), are reported as unavailable instead of
+/// failing. Only user space is counted. If the PMU multiplexes counters,
+/// values are scaled by the time they were running.
+class PerfCounters {
+    public:
+        PerfCounters() = default;
+
+        PerfCounters(const PerfCounters&) = delete;
+        PerfCounters& operator=(const PerfCounters&) = delete;
+
+        ~PerfCounters();
+
+        /// Opens counters for the calling thread, is thread-safe
+        void attach_current_thread();
+
+        /// Counted by at least one thread
+        bool is_available(Counter counter) const {
+            return available[(size_t) counter];
+        }
+
+        std::array<bool, COUNTERS_COUNT> get_available() const {
+            return available;
+        }
+
+        /// Sum over the attached threads since they were attached
+        CounterValues read() const;
+
+    private:
+        mutable std::mutex mtx;
+        /// Per thread, -1 for counters, that failed to open
+        std::vector<std::array<int, COUNTERS_COUNT>> fds;
+        std::array<bool, COUNTERS_COUNT> available{};
+};
+
+/// Table of counters per tick for each phase, with instructions per cycle
+void print_counters(std::ostream& out, const PhaseStats& stats);
+
+/// Totals of counters for each phase as a JSON object. Counters, that are not
+/// available, are null.
+void write_counters_json(std::ostream& out, const PhaseStats& stats);
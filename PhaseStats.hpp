@@ -0,0 +1,63 @@
+#pragma once
+
+#include "PerfCounters.hpp"
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <string_view>
+
+/// Phases of Fluid::tick
+enum class Phase {
+    /// Gravity and forces from p, fused or not
+    FORCES,
+    RECALC_FLOW,
+    RECALC_P,
+    PROPAGATE,
+};
+
+constexpr size_t PHASES_COUNT = 4;
+
+constexpr std::array<std::string_view, PHASES_COUNT> phase_names{
+    "forces",
+    "recalc_flow",
+    "recalc_p",
+    "propagate",
+};
+
+/// Wall-clock time, spent in each phase
+struct PhaseStats {
+    using clock = std::chrono::steady_clock;
+    using duration = std::chrono::duration<double>;
+
+    size_t ticks = 0;
+    std::array<duration, PHASES_COUNT> time{};
+
+    /// Passes of recalc_flow over the grid, it repeats them until no flow
+    /// is found
+    size_t flow_sweeps = 0;
+    /// Chains of moves, that maybe_propagate has started
+    size_t moves = 0;
+
+    /// Hardware counters of each phase summed over threads, are collected
+    /// with FluidOptions::perf_counters only
+    std::array<CounterValues, PHASES_COUNT> counters{};
+    /// None, if counters are not collected
+    std::array<bool, COUNTERS_COUNT> counters_available{};
+
+    duration& operator[](Phase phase) {
+        return time[(size_t) phase];
+    }
+
+    const duration& operator[](Phase phase) const {
+        return time[(size_t) phase];
+    }
+
+    duration total() const {
+        duration ans{};
+        for (auto t : time) {
+            ans += t;
+        }
+        return ans;
+    }
+};
@@ -0,0 +1,272 @@
+#include "Protocol.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <type_traits>
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace {
+    /// Larger messages are rejected, so that a broken client can not make
+    /// the server allocate arbitrary amounts of memory
+    constexpr uint32_t MAX_MESSAGE_SIZE = 1 << 30;
+
+    class Writer {
+        public:
+            template<typename T>
+            requires std::is_arithmetic_v<T>
+            Writer& operator<<(T x) {
+                out.append(reinterpret_cast<const char*>(&x), sizeof(x));
+                return *this;
+            }
+
+            Writer& operator<<(const std::string& s) {
+                *this << (uint32_t) s.size();
+                out += s;
+                return *this;
+            }
+
+            template<typename T>
+            Writer& operator<<(const std::vector<T>& v) {
+                *this << (uint32_t) v.size();
+                for (const auto& x : v) {
+                    *this << x;
+                }
+                return *this;
+            }
+
+            std::string take() {
+                return std::move(out);
+            }
+
+        private:
+            std::string out;
+    };
+
+    class Reader {
+        public:
+            explicit Reader(const std::string& in)
+              : in(in)
+            {}
+
+            template<typename T>
+            requires std::is_arithmetic_v<T>
+            Reader& operator>>(T& x) {
+                std::memcpy(&x, take(sizeof(x)), sizeof(x));
+                return *this;
+            }
+
+            Reader& operator>>(std::string& s) {
+                uint32_t size;
+                *this >> size;
+                s.assign(take(size), size);
+                return *this;
+            }
+
+            template<typename T>
+            Reader& operator>>(std::vector<T>& v) {
+                uint32_t size;
+                *this >> size;
+                if (size > in.size() - pos) {
+                    throw std::runtime_error("malformed message");
+                }
+                v.resize(size);
+                for (auto& x : v) {
+                    *this >> x;
+                }
+                return *this;
+            }
+
+            void finish() const {
+                if (pos != in.size()) {
+                    throw std::runtime_error("malformed message");
+                }
+            }
+
+        private:
+            const char* take(size_t bytes) {
+                if (bytes > in.size() - pos) {
+                    throw std::runtime_error("malformed message");
+                }
+                const char* ans = in.data() + pos;
+                pos += bytes;
+                return ans;
+            }
+
+            const std::string& in;
+            size_t pos = 0;
+    };
+
+    void write_all(int fd, const char* data, size_t size) {
+        while (size > 0) {
+            // MSG_NOSIGNAL: a client, that has gone away, is an error of
+            // the job, not a SIGPIPE for the whole server
+            ssize_t written = send(fd, data, size, MSG_NOSIGNAL);
+            if (written < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                throw std::runtime_error(std::string("failed to send message: ") + std::strerror(errno));
+            }
+            data += written;
+            size -= written;
+        }
+    }
+
+    /// Returns false on end of stream before the first byte
+    bool read_all(int fd, char* data, size_t size) {
+        size_t done = 0;
+        while (done < size) {
+            ssize_t got = read(fd, data + done, size - done);
+            if (got < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                throw std::runtime_error(std::string("failed to receive message: ") + std::strerror(errno));
+            }
+            if (got == 0) {
+                if (done == 0) {
+                    return false;
+                }
+                throw std::runtime_error("truncated message");
+            }
+            done += got;
+        }
+        return true;
+    }
+
+    Reader reader_for(const Message& message, MessageType type) {
+        if (message.type == MessageType::ERROR && type != MessageType::ERROR) {
+            throw std::runtime_error("server error: " + decode_error(message));
+        }
+        if (message.type != type) {
+            throw std::runtime_error("unexpected message type");
+        }
+        return Reader(message.payload);
+    }
+}
+
+void send_message(int fd, const Message& message) {
+    std::string header(sizeof(uint32_t) + 1, '\0');
+    uint32_t size = message.payload.size();
+    std::memcpy(header.data(), &size, sizeof(size));
+    header[sizeof(size)] = (char) message.type;
+    write_all(fd, header.data(), header.size());
+    write_all(fd, message.payload.data(), message.payload.size());
+}
+
+std::optional<Message> receive_message(int fd) {
+    char header[sizeof(uint32_t) + 1];
+    if (!read_all(fd, header, sizeof(header))) {
+        return std::nullopt;
+    }
+    uint32_t size;
+    std::memcpy(&size, header, sizeof(size));
+    if (size > MAX_MESSAGE_SIZE) {
+        throw std::runtime_error("message is too large");
+    }
+
+    Message message{
+        .type = (MessageType) header[sizeof(size)],
+        .payload = std::string(size, '\0'),
+    };
+    if (size > 0 && !read_all(fd, message.payload.data(), size)) {
+        throw std::runtime_error("truncated message");
+    }
+    return message;
+}
+
+Message encode(const JobRequest& request) {
+    Writer w;
+    w << request.scenario << (uint8_t) request.scenario_is_path
+      << request.types.p_type << request.types.v_type << request.types.v_flow_type
+      << request.ticks << request.seed << request.progress_every << request.frame_every;
+    return {MessageType::JOB, w.take()};
+}
+
+Message encode(const JobProgress& progress) {
+    Writer w;
+    w << progress.tick << (uint8_t) progress.moved;
+    return {MessageType::PROGRESS, w.take()};
+}
+
+Message encode(const JobFrame& frame) {
+    Writer w;
+    w << frame.tick << frame.n << frame.m << frame.field;
+    return {MessageType::FRAME, w.take()};
+}
+
+Message encode(const JobResult& result) {
+    const auto& snapshot = result.snapshot;
+    Writer w;
+    w << result.ticks_done << result.seconds
+      << (uint32_t) snapshot.n << (uint32_t) snapshot.m << snapshot.field << snapshot.p;
+    for (double center : snapshot.center) {
+        w << center;
+    }
+    return {MessageType::RESULT, w.take()};
+}
+
+Message encode_error(const std::string& error) {
+    Writer w;
+    w << error;
+    return {MessageType::ERROR, w.take()};
+}
+
+JobRequest decode_request(const Message& message) {
+    auto r = reader_for(message, MessageType::JOB);
+    JobRequest request;
+    uint8_t scenario_is_path;
+    r >> request.scenario >> scenario_is_path
+      >> request.types.p_type >> request.types.v_type >> request.types.v_flow_type
+      >> request.ticks >> request.seed >> request.progress_every >> request.frame_every;
+    r.finish();
+    request.scenario_is_path = scenario_is_path;
+    return request;
+}
+
+JobProgress decode_progress(const Message& message) {
+    auto r = reader_for(message, MessageType::PROGRESS);
+    JobProgress progress;
+    uint8_t moved;
+    r >> progress.tick >> moved;
+    r.finish();
+    progress.moved = moved;
+    return progress;
+}
+
+JobFrame decode_frame(const Message& message) {
+    auto r = reader_for(message, MessageType::FRAME);
+    JobFrame frame;
+    r >> frame.tick >> frame.n >> frame.m >> frame.field;
+    r.finish();
+    if (frame.field.size() != (size_t) frame.n * frame.m) {
+        throw std::runtime_error("malformed message");
+    }
+    return frame;
+}
+
+JobResult decode_result(const Message& message) {
+    auto r = reader_for(message, MessageType::RESULT);
+    JobResult result;
+    auto& snapshot = result.snapshot;
+    uint32_t n, m;
+    r >> result.ticks_done >> result.seconds >> n >> m >> snapshot.field >> snapshot.p;
+    for (double& center : snapshot.center) {
+        r >> center;
+    }
+    r.finish();
+    snapshot.n = n;
+    snapshot.m = m;
+    return result;
+}
+
+std::string decode_error(const Message& message) {
+    auto r = reader_for(message, MessageType::ERROR);
+    std::string error;
+    r >> error;
+    r.finish();
+    return error;
+}
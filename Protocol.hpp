@@ -0,0 +1,84 @@
+#pragma once
+
+#include "Simulation.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+/// Messages between fluid-server and its clients over a Unix socket.
+///
+/// Each message is a 4-byte payload length, a 1-byte type and the payload.
+/// Integers are in the byte order of the host (both ends are on the same
+/// machine), strings are a 4-byte length and the bytes.
+///
+/// A connection carries a single job: the client sends JOB, the server
+/// answers with any number of PROGRESS and FRAME messages, then with
+/// either RESULT or ERROR, and closes the connection.
+enum class MessageType : uint8_t {
+    JOB = 1,
+    PROGRESS = 2,
+    FRAME = 3,
+    RESULT = 4,
+    ERROR = 5,
+};
+
+struct JobRequest {
+    /// Text of the scenario or, if scenario_is_path, a path on the server
+    std::string scenario;
+    bool scenario_is_path = false;
+    SimulationTypes types;
+    uint64_t ticks = 0;
+    uint32_t seed = Rnd::DEFAULT_SEED;
+    /// Send PROGRESS every that many ticks, 0 for none
+    uint64_t progress_every = 0;
+    /// Send FRAME every that many ticks, 0 for none
+    uint64_t frame_every = 0;
+};
+
+struct JobProgress {
+    uint64_t tick = 0;
+    bool moved = false;
+};
+
+/// Field after a tick, n x m without the extra column
+struct JobFrame {
+    uint64_t tick = 0;
+    uint32_t n = 0, m = 0;
+    std::string field;
+};
+
+struct JobResult {
+    uint64_t ticks_done = 0;
+    double seconds = 0;
+    FluidSnapshot snapshot;
+};
+
+/// Raw message without the length prefix
+struct Message {
+    MessageType type;
+    std::string payload;
+};
+
+/// Writes the whole message to the socket. Throws, if the peer is gone.
+void send_message(int fd, const Message& message);
+
+/// Reads the next message. Returns nullopt on a clean end of stream before
+/// the message, throws on a truncated or oversized message.
+std::optional<Message> receive_message(int fd);
+
+Message encode(const JobRequest& request);
+Message encode(const JobProgress& progress);
+Message encode(const JobFrame& frame);
+Message encode(const JobResult& result);
+Message encode_error(const std::string& error);
+
+/// Each decode checks the type of the message and throws, if the payload is
+/// malformed
+JobRequest decode_request(const Message& message);
+JobProgress decode_progress(const Message& message);
+JobFrame decode_frame(const Message& message);
+JobResult decode_result(const Message& message);
+std::string decode_error(const Message& message);
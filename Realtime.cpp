@@ -0,0 +1,214 @@
+#include "Realtime.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <condition_variable>
+#include <mutex>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+namespace {
+    using clock = std::chrono::steady_clock;
+
+    /// Text of the field with the number of the tick
+    std::string render(const Simulation& simulation) {
+        auto field = simulation.field();
+        std::string ans = "Tick " + std::to_string(simulation.get_tick() - 1) + ":\n";
+        ans.reserve(ans.size() + field.get_n() * (field.get_m() + 1));
+        for (size_t x = 0; x < field.get_n(); ++x) {
+            for (size_t y = 0; y < field.get_m(); ++y) {
+                ans += field(x, y);
+            }
+            ans += '\n';
+        }
+        return ans;
+    }
+
+    /// Writes the latest frame on its own thread, see run_realtime
+    class FrameWriter {
+        public:
+            FrameWriter(std::ostream& out, bool redraw, RealtimeStats& stats)
+              : out(out),
+                redraw(redraw),
+                stats(stats),
+                thread(&FrameWriter::run, this)
+            {}
+
+            ~FrameWriter() {
+                finish();
+            }
+
+            /// Writes the pending frame and stops
+            void finish() {
+                if (!thread.joinable()) {
+                    return;
+                }
+                {
+                    std::lock_guard lock(mtx);
+                    need_to_stop = true;
+                }
+                cv.notify_one();
+                thread.join();
+            }
+
+            /// Replaces the pending frame, if the output has not taken it
+            void submit(std::string frame) {
+                {
+                    std::lock_guard lock(mtx);
+                    if (has_pending) {
+                        ++stats.dropped_frames;
+                    }
+                    pending = std::move(frame);
+                    pending_time = clock::now();
+                    has_pending = true;
+                }
+                cv.notify_one();
+            }
+
+        private:
+            void run() {
+                std::string frame;
+                std::unique_lock lock(mtx);
+                for (;;) {
+                    cv.wait(lock, [this] { return has_pending || need_to_stop; });
+                    if (!has_pending) {
+                        return;
+                    }
+                    frame.swap(pending);
+                    auto frame_time = pending_time;
+                    has_pending = false;
+                    lock.unlock();
+
+                    if (redraw) {
+                        // Cursor home, then the frame over the previous one
+                        out << "\x1b[H" << frame << "\x1b[J";
+                    } else {
+                        out << frame << "\n";
+                    }
+                    out.flush();
+
+                    lock.lock();
+                    ++stats.frames;
+                    stats.frame_latency.add(clock::now() - frame_time);
+                }
+            }
+
+            std::ostream& out;
+            bool redraw;
+            /// Frame counts and frame_latency are guarded by mtx
+            RealtimeStats& stats;
+
+            std::mutex mtx;
+            std::condition_variable cv;
+            std::string pending;
+            clock::time_point pending_time;
+            bool has_pending = false;
+            bool need_to_stop = false;
+            std::thread thread;
+    };
+}
+
+void LatencyHistogram::add(duration latency) {
+    double us = std::chrono::duration<double, std::micro>(latency).count();
+    size_t bucket = us < 1 ? 0 : std::min<size_t>(BUCKETS - 1, std::ilogb(us) + 1);
+    ++buckets[bucket];
+    ++total;
+    max_latency = std::max(max_latency, latency);
+}
+
+LatencyHistogram::duration LatencyHistogram::upper_bound(size_t bucket) {
+    return std::chrono::duration<double, std::micro>(std::ldexp(1.0, bucket));
+}
+
+LatencyHistogram::duration LatencyHistogram::quantile(double q) const {
+    size_t rank = std::ceil(q * total);
+    size_t seen = 0;
+    for (size_t i = 0; i < BUCKETS; ++i) {
+        seen += buckets[i];
+        if (seen >= rank && seen > 0) {
+            return std::min(upper_bound(i), max_latency);
+        }
+    }
+    return max_latency;
+}
+
+void LatencyHistogram::print(std::ostream& out, std::string_view name) const {
+    auto us = [](duration d) {
+        return std::chrono::duration<double, std::micro>(d).count();
+    };
+    out << name << " (" << total << "): p50 <= " << us(quantile(0.5)) << "us, p90 <= "
+        << us(quantile(0.9)) << "us, p99 <= " << us(quantile(0.99)) << "us, max "
+        << us(max_latency) << "us\n";
+    for (size_t i = 0; i < BUCKETS; ++i) {
+        if (buckets[i] > 0) {
+            out << "    < " << us(upper_bound(i)) << "us: " << buckets[i] << "\n";
+        }
+    }
+}
+
+RealtimeStats run_realtime(
+    Simulation& simulation,
+    double fps,
+    size_t ticks_count,
+    std::ostream& out,
+    bool redraw
+) {
+    if (!(fps > 0)) {
+        throw std::runtime_error("frame rate should be positive");
+    }
+    auto budget = std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(1 / fps));
+
+    RealtimeStats stats;
+    if (ticks_count == 0) {
+        return stats;
+    }
+    if (redraw) {
+        out << "\x1b[2J" << std::flush;
+    }
+
+    // The writer updates stats, until it has written the last frame
+    FrameWriter writer(out, redraw, stats);
+    auto frame_start = clock::now();
+    clock::duration last_tick{};
+    for (;;) {
+        auto deadline = frame_start + budget;
+        bool stop = false;
+        // A tick, that is expected to overrun the frame, is left for the
+        // next one
+        do {
+            auto tick_start = clock::now();
+            simulation.step(1, true);
+            last_tick = clock::now() - tick_start;
+            stats.tick_latency.add(last_tick);
+            ++stats.ticks;
+            stop = stats.ticks == ticks_count || simulation.is_steady() || simulation.is_stop_requested();
+        } while (!stop && clock::now() + last_tick < deadline);
+
+        writer.submit(render(simulation));
+        if (stop) {
+            break;
+        }
+
+        auto now = clock::now();
+        if (now < deadline) {
+            std::this_thread::sleep_until(deadline);
+            frame_start = deadline;
+        } else {
+            // Late frames are not caught up with
+            ++stats.late_frames;
+            frame_start = now;
+        }
+    }
+    writer.finish();
+    return stats;
+}
+
+void print_realtime_stats(std::ostream& out, const RealtimeStats& stats) {
+    out << "\nRealtime: " << stats.ticks << " ticks, " << stats.frames << " frames, "
+        << stats.dropped_frames << " dropped, " << stats.late_frames << " late\n";
+    stats.tick_latency.print(out, "Tick latency");
+    stats.frame_latency.print(out, "Frame latency");
+    out << std::flush;
+}
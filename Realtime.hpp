@@ -0,0 +1,74 @@
+#pragma once
+
+#include "Simulation.hpp"
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <iosfwd>
+#include <string_view>
+
+/// Counts of latencies in power of two buckets: bucket 0 is below 1us,
+/// bucket i is [2^(i-1), 2^i) us
+class LatencyHistogram {
+    public:
+        using duration = std::chrono::duration<double>;
+
+        void add(duration latency);
+
+        size_t count() const {
+            return total;
+        }
+
+        /// Upper bound of the bucket, that contains the quantile q
+        duration quantile(double q) const;
+
+        duration max() const {
+            return max_latency;
+        }
+
+        /// Quantiles and non-empty buckets
+        void print(std::ostream& out, std::string_view name) const;
+
+    private:
+        static constexpr size_t BUCKETS = 32;
+
+        static duration upper_bound(size_t bucket);
+
+        std::array<size_t, BUCKETS> buckets{};
+        size_t total = 0;
+        duration max_latency{};
+};
+
+struct RealtimeStats {
+    size_t ticks = 0;
+    /// Frames, that were written to the output
+    size_t frames = 0;
+    /// Frames, that were replaced by a newer one before the output took
+    /// them
+    size_t dropped_frames = 0;
+    /// Frames, whose ticks did not fit into the budget
+    size_t late_frames = 0;
+    /// Duration of each tick
+    LatencyHistogram tick_latency;
+    /// From the state of a frame to the end of its output
+    LatencyHistogram frame_latency;
+};
+
+/// Runs up to ticks_count ticks at fps frames per second, e.g. for demos.
+/// Each frame runs as many ticks as fit into its budget (at least one) and
+/// renders only the latest state. Frames are written by a separate thread:
+/// while it is blocked on a slow terminal, newer frames replace the pending
+/// one, so ticks never wait for the output. If redraw, each frame is drawn
+/// over the previous one with ANSI escapes.
+///
+/// Stops early at the steady state or on Simulation::request_stop.
+RealtimeStats run_realtime(
+    Simulation& simulation,
+    double fps,
+    size_t ticks_count,
+    std::ostream& out,
+    bool redraw
+);
+
+void print_realtime_stats(std::ostream& out, const RealtimeStats& stats);
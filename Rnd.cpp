@@ -1,3 +0,0 @@
-#include "Rnd.hpp"
-
-std::mt19937 Rnd::rnd{1337};
@@ -1,14 +1,87 @@
 #pragma once
 
+#include "FixedInner.hpp"
+
+#include <bit>
+#include <cstdint>
+#include <limits>
 #include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
 
+/// Random generator of a simulation. Each simulation has its own, so that
+/// several simulations in a process do not affect each other.
 class Rnd {
     public:
+        using seed_type = std::mt19937::result_type;
+
+        static constexpr seed_type DEFAULT_SEED = 1337;
+
+        explicit Rnd(seed_type seed = DEFAULT_SEED)
+          : rnd(seed)
+        {}
+
         template<typename T>
-        static T random01() {
-            return T(std::uniform_real_distribution<>{0, 1}(rnd));
+        T random01() {
+            if constexpr (IsFixedInner<T>::value) {
+                return T::from_raw(fixed_random01(T::k));
+            } else {
+                return T(std::uniform_real_distribution<>{0, 1}(rnd));
+            }
+        }
+
+        void seed(seed_type value) {
+            rnd.seed(value);
+        }
+
+        /// Full state in the text form of std::mt19937, e.g. for checkpoints
+        std::string state() const {
+            std::stringstream ss;
+            ss << rnd;
+            return ss.str();
+        }
+
+        void set_state(const std::string& state) {
+            std::stringstream ss(state);
+            if (!(ss >> rnd)) {
+                throw std::runtime_error("wrong state of random generator");
+            }
         }
 
     private:
-        static std::mt19937 rnd;
+        std::mt19937 rnd;
+
+        /// Raw value of a fixed point number with k fractional bits, that is
+        /// bit-exactly the same as FixedInner(uniform_real_distribution<>{0, 1}),
+        /// but without floating point.
+        ///
+        /// libstdc++ builds the double from two 32-bit draws as
+        /// (a + b * 2^32) / 2^64, the sum is rounded to 53 bits (to nearest,
+        /// ties to even), and 1.0 is replaced with the largest double below it.
+        /// FixedInner then takes floor(x * 2^k).
+        uint64_t fixed_random01(size_t k) {
+            static_assert(std::mt19937::min() == 0 && std::mt19937::max() == UINT32_MAX);
+
+            uint64_t a = rnd();
+            uint64_t b = rnd();
+            uint64_t sum = a + (b << 32);
+
+            int width = std::bit_width(sum);
+            if (width > std::numeric_limits<double>::digits) {
+                int shift = width - std::numeric_limits<double>::digits;
+                uint64_t rest = sum & ((uint64_t(1) << shift) - 1);
+                uint64_t half = uint64_t(1) << (shift - 1);
+                sum >>= shift;
+                if (rest > half || (rest == half && (sum & 1))) {
+                    ++sum;
+                }
+                if (std::bit_width(sum) + shift > 64) {
+                    // Rounded up to 1.0
+                    return (uint64_t(1) << k) - 1;
+                }
+                sum <<= shift;
+            }
+            return k == 0 ? 0 : sum >> (64 - k);
+        }
 };
@@ -0,0 +1,103 @@
+#include "Scaling.hpp"
+
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+std::string read_scenario(const std::string& filename) {
+    std::ifstream fin(filename);
+    if (!fin) {
+        throw std::runtime_error("failed to open file");
+    }
+    std::stringstream ss;
+    ss << fin.rdbuf();
+    return ss.str();
+}
+
+std::string widen_scenario(const std::string& scenario, size_t k) {
+    std::stringstream in(scenario);
+    std::stringstream out;
+
+    // Same structure as in Fluid::read: "N M" line, then N lines of field,
+    // comments are copied as is
+    std::string line;
+    size_t n = 0, m = 0;
+    size_t field_lines_left = 0;
+    bool size_read = false;
+    while (std::getline(in, line)) {
+        if (line.starts_with("//")) {
+            out << line << "\n";
+        } else if (!size_read) {
+            std::stringstream ss(line);
+            if (!(ss >> n >> m)) {
+                throw std::runtime_error("failed to read N or M");
+            }
+            out << n << " " << m * k << "\n";
+            field_lines_left = n;
+            size_read = true;
+        } else if (field_lines_left > 0) {
+            for (size_t i = 0; i < k; ++i) {
+                out << line;
+            }
+            out << "\n";
+            --field_lines_left;
+        } else {
+            out << line << "\n";
+        }
+    }
+    return out.str();
+}
+
+void run_scaling(
+    const std::string& scenario,
+    const SimulationTypes& types,
+    FluidOptions options,
+    size_t ticks_count,
+    size_t max_threads,
+    bool weak
+) {
+    std::vector<PhaseStats> stats;
+    for (size_t threads = 1; threads <= max_threads; ++threads) {
+        options.threads = threads;
+        auto simulation = Simulation::create(
+            weak ? widen_scenario(scenario, threads) : scenario,
+            types,
+            options
+        );
+        simulation->step(ticks_count);
+        stats.push_back(simulation->get_phase_stats());
+    }
+
+    std::cout
+        << "\n" << (weak ? "Weak" : "Strong") << " scaling, "
+        << ticks_count << " ticks:\n"
+        << std::left
+        << std::setw(9) << "threads"
+        << std::setw(13) << "phase"
+        << std::setw(15) << "ms/tick"
+        << std::setw(9) << "speedup"
+        << "efficiency\n";
+
+    auto print_row = [&](size_t threads, std::string_view name, double base, double time) {
+        double speedup = base / time;
+        double efficiency = weak ? speedup : speedup / threads;
+        std::cout
+            << std::setw(9) << threads
+            << std::setw(13) << name
+            << std::setw(15) << time * 1000 / ticks_count
+            << std::setw(9) << std::setprecision(3) << speedup
+            << std::setprecision(3) << efficiency << "\n"
+            << std::setprecision(6);
+    };
+
+    for (size_t i = 0; i < stats.size(); ++i) {
+        for (size_t phase = 0; phase < PHASES_COUNT; ++phase) {
+            print_row(i + 1, phase_names[phase], stats[0].time[phase].count(), stats[i].time[phase].count());
+        }
+        print_row(i + 1, "total", stats[0].total().count(), stats[i].total().count());
+    }
+    std::cout << std::right << std::flush;
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include "FluidOptions.hpp"
+#include "Simulation.hpp"
+
+#include <cstddef>
+#include <string>
+
+/// Reads the whole scenario file
+std::string read_scenario(const std::string& filename);
+
+/// Repeats the field of the scenario k times horizontally. Is used for weak
+/// scaling: the amount of work grows with the number of threads.
+std::string widen_scenario(const std::string& scenario, size_t k);
+
+/// Runs the scenario for 1..max_threads threads and prints time per tick,
+/// speedup and efficiency of each phase.
+///
+/// Strong scaling runs the same scenario each time, so the ideal speedup is
+/// the number of threads. Weak scaling widens the scenario proportionally to
+/// the number of threads, so the ideal time per tick is constant.
+void run_scaling(
+    const std::string& scenario,
+    const SimulationTypes& types,
+    FluidOptions options,
+    size_t ticks_count,
+    size_t max_threads,
+    bool weak
+);
@@ -0,0 +1,226 @@
+#pragma once
+
+#include "Matrix.hpp"
+#include "ThreadPool.hpp"
+
+#include <algorithm>
+#include <array>
+#include <concepts>
+#include <cstddef>
+#include <functional>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+/// Which cells a phase writes, when it processes a single cell
+enum class Footprint {
+    /// Only the cell itself
+    OWN,
+    /// The cell and all four of its neighbours
+    NEIGHBOURS,
+};
+
+/// Rectangle of cells [x_begin, x_end) x [y_begin, y_end)
+struct Tile {
+    size_t index;
+    /// Thread, that processes the tile, if tiles are owned
+    size_t owner;
+    size_t x_begin, x_end;
+    size_t y_begin, y_end;
+};
+
+/// Splits the grid into tiles and runs phases over them in parallel.
+///
+/// Tiles are colored, so that tiles of the same color never write the same
+/// cell, and each color is a separate pass with a barrier after it. The
+/// number of colors depends on the footprint of the phase:
+///     OWN        -- a single pass: plain parallel-for;
+///     NEIGHBOURS -- tile rows and tile columns are colored, 2 colors each if
+///                   tiles are at least 2 cells thick, 3 colors otherwise,
+///                   e.g. red-black for full-width bands of 2+ rows or the
+///                   3-stripe schedule for bands of a single row.
+/// Tiles of a single color are always processed in the same order cell by
+/// cell, so results do not depend on the number of threads.
+///
+/// If tiles are owned, each tile is always processed by the same thread of the
+/// pool (threads get contiguous ranges of tiles), so data of a tile stays in
+/// the cache and on the NUMA node of its thread across phases.
+class TileScheduler {
+    public:
+        /// tile_m == 0 means full-width tiles (bands of rows). If chunks are
+        /// given, tiles are the chunks of the map instead, and chunks of
+        /// walls only are not processed at all.
+        TileScheduler(
+            ThreadPool& pool,
+            size_t n,
+            size_t m,
+            size_t tile_n,
+            size_t tile_m,
+            bool owned = false,
+            const ChunkMap* chunks = nullptr
+        )
+          : group(pool),
+            owned(owned),
+            threads(pool.threads_count())
+        {
+            if (chunks != nullptr) {
+                tile_n = tile_m = ChunkMap::CHUNK;
+            }
+            if (tile_n == 0) {
+                throw std::runtime_error("tile height should be positive");
+            }
+            if (tile_m == 0 || tile_m > m) {
+                tile_m = m;
+            }
+
+            size_t tiles_n = (n + tile_n - 1) / tile_n;
+            size_t tiles_m = (m + tile_m - 1) / tile_m;
+            // Position of each tile in the grid of tiles
+            std::vector<std::pair<size_t, size_t>> positions;
+            for (size_t ti = 0; ti < tiles_n; ++ti) {
+                for (size_t tj = 0; tj < tiles_m; ++tj) {
+                    if (chunks != nullptr && !chunks->is_active(ti, tj)) {
+                        continue;
+                    }
+                    positions.emplace_back(ti, tj);
+                }
+            }
+
+            for (auto [ti, tj] : positions) {
+                tiles.push_back(Tile {
+                    .index = tiles.size(),
+                    .owner = tiles.size() * threads / positions.size(),
+                    .x_begin = ti * tile_n,
+                    .x_end = std::min(n, (ti + 1) * tile_n),
+                    .y_begin = tj * tile_m,
+                    .y_end = std::min(m, (tj + 1) * tile_m),
+                });
+            }
+
+            // A tile only writes one cell outside of itself, so tiles two
+            // apart never conflict, unless the tile between them is one cell
+            // thick
+            auto colors_count = [](size_t tiles_count, size_t tile_size) -> size_t {
+                if (tiles_count == 1) {
+                    return 1;
+                }
+                return tile_size >= 2 ? 2 : 3;
+            };
+            size_t row_colors = colors_count(tiles_n, tile_n);
+            size_t col_colors = colors_count(tiles_m, tile_m);
+
+            auto make_passes = [&](size_t row_colors, size_t col_colors) {
+                std::vector<std::vector<size_t>> passes(row_colors * col_colors);
+                for (size_t i = 0; i < positions.size(); ++i) {
+                    auto [ti, tj] = positions[i];
+                    size_t color = (ti % row_colors) * col_colors + tj % col_colors;
+                    passes[color].push_back(i);
+                }
+                return passes;
+            };
+            passes[(size_t) Footprint::OWN] = make_passes(1, 1);
+            passes[(size_t) Footprint::NEIGHBOURS] = make_passes(row_colors, col_colors);
+        }
+
+        size_t tiles_count() const {
+            return tiles.size();
+        }
+
+        /// Number of barriers, that a phase with the footprint takes
+        size_t passes_count(Footprint footprint) const {
+            return passes[(size_t) footprint].size();
+        }
+
+        /// Restricts processing to tiles of rows [x_begin, x_end), the rest
+        /// of the grid is processed by other processes (see SlabGroup).
+        /// Passes keep the colors of the whole grid, barrier is called after
+        /// each of them. Rows should be bounds of tiles.
+        void set_slab(size_t x_begin, size_t x_end, std::function<void()> barrier) {
+            auto is_local = [this, x_begin, x_end](size_t tile_index) {
+                return tiles[tile_index].x_begin >= x_begin && tiles[tile_index].x_end <= x_end;
+            };
+            for (auto& footprint_passes : passes) {
+                for (auto& pass : footprint_passes) {
+                    std::erase_if(pass, [&is_local](size_t tile_index) {
+                        return !is_local(tile_index);
+                    });
+                }
+            }
+
+            // Threads get contiguous ranges of the local tiles
+            std::vector<size_t> local;
+            for (size_t i = 0; i < tiles.size(); ++i) {
+                if (is_local(i)) {
+                    local.push_back(i);
+                }
+            }
+            for (size_t i = 0; i < local.size(); ++i) {
+                tiles[local[i]].owner = i * threads / local.size();
+            }
+            slab_barrier = std::move(barrier);
+        }
+
+        /// Are called by the task of each tile around the work of a phase,
+        /// e.g. to prefetch the memory of the tile and to release it
+        void set_tile_hooks(std::function<void(const Tile&)> before, std::function<void(const Tile&)> after) {
+            before_tile = std::move(before);
+            after_tile = std::move(after);
+        }
+
+        template<Footprint FP, typename F>
+        requires requires(const F& f, const Tile& tile) {
+            { f(tile) } -> std::same_as<void>;
+        }
+        void forall_tiles(const F& f) {
+            for (const auto& pass : passes[(size_t) FP]) {
+                for (size_t tile_index : pass) {
+                    const auto& tile = tiles[tile_index];
+                    auto task = [this, &f, &tile]{
+                        if (before_tile) {
+                            before_tile(tile);
+                        }
+                        f(tile);
+                        if (after_tile) {
+                            after_tile(tile);
+                        }
+                    };
+                    if (owned) {
+                        group.add_task_for(tile.owner, task);
+                    } else {
+                        group.add_task(task);
+                    }
+                }
+                group.wait();
+                if (slab_barrier) {
+                    slab_barrier();
+                }
+            }
+        }
+
+        template<Footprint FP, typename F>
+        requires requires(const F& f, size_t x, size_t y) {
+            { f(x, y) } -> std::same_as<void>;
+        }
+        void forall(const F& f) {
+            forall_tiles<FP>([&f](const Tile& tile) {
+                for (size_t x = tile.x_begin; x < tile.x_end; ++x) {
+                    for (size_t y = tile.y_begin; y < tile.y_end; ++y) {
+                        f(x, y);
+                    }
+                }
+            });
+        }
+
+    private:
+        /// The pool may be shared with other simulations, so only own tasks
+        /// are waited for
+        TaskGroup group;
+        std::function<void(const Tile&)> before_tile;
+        std::function<void(const Tile&)> after_tile;
+        std::function<void()> slab_barrier;
+        bool owned;
+        size_t threads;
+
+        std::vector<Tile> tiles;
+        std::array<std::vector<std::vector<size_t>>, 2> passes;
+};
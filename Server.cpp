@@ -0,0 +1,143 @@
+#include "Server.hpp"
+
+#include "Scaling.hpp"
+
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <utility>
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace {
+    /// How often the accept loop checks need_to_stop
+    constexpr int STOP_CHECK_MS = 200;
+}
+
+Server::Server(std::string socket_path, const FluidOptions& options)
+  : socket_path(std::move(socket_path)),
+    options(options),
+    pool(options.threads, options.pinning)
+{
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    if (this->socket_path.size() >= sizeof(addr.sun_path)) {
+        throw std::runtime_error("socket path is too long");
+    }
+    std::strcpy(addr.sun_path, this->socket_path.c_str());
+
+    listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listen_fd < 0) {
+        throw std::runtime_error("failed to create socket");
+    }
+    // A socket file, that is left after a previous run, would fail bind
+    unlink(this->socket_path.c_str());
+    if (bind(listen_fd, (const sockaddr*) &addr, sizeof(addr)) != 0 || listen(listen_fd, SOMAXCONN) != 0) {
+        close(listen_fd);
+        throw std::runtime_error(std::string("failed to listen on socket: ") + std::strerror(errno));
+    }
+}
+
+Server::~Server() {
+    reap(true);
+    close(listen_fd);
+    unlink(socket_path.c_str());
+}
+
+void Server::run() {
+    while (!need_to_stop) {
+        pollfd pfd{.fd = listen_fd, .events = POLLIN};
+        int ready = poll(&pfd, 1, STOP_CHECK_MS);
+        reap(false);
+        if (ready <= 0) {
+            continue;
+        }
+
+        int fd = accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+        if (fd < 0) {
+            continue;
+        }
+        auto& connection = connections.emplace_back();
+        connection.fd = fd;
+        connection.thread = std::thread(&Server::serve, this, std::ref(connection));
+    }
+}
+
+void Server::serve(Connection& connection) {
+    try {
+        try {
+            auto message = receive_message(connection.fd);
+            if (message) {
+                auto result = run_job(connection.fd, decode_request(*message));
+                send_message(connection.fd, encode(result));
+            }
+        } catch (const std::exception& e) {
+            send_message(connection.fd, encode_error(e.what()));
+        }
+    } catch (const std::exception& e) {
+        // The client has gone away
+        std::cerr << "Job failed: " << e.what() << std::endl;
+    }
+    close(connection.fd);
+    connection.done = true;
+}
+
+JobResult Server::run_job(int fd, const JobRequest& request) {
+    auto job_options = options;
+    job_options.pool = &pool;
+    job_options.seed = request.seed;
+
+    auto simulation = Simulation::create(
+        request.scenario_is_path ? read_scenario(request.scenario) : request.scenario,
+        request.types,
+        job_options
+    );
+
+    if (request.progress_every > 0 || request.frame_every > 0) {
+        simulation->on_tick([fd, &request](const Simulation& simulation, const TickInfo& info) {
+            if (request.progress_every > 0 && (info.tick + 1) % request.progress_every == 0) {
+                send_message(fd, encode(JobProgress{.tick = info.tick, .moved = info.moved}));
+            }
+            if (request.frame_every > 0 && (info.tick + 1) % request.frame_every == 0) {
+                auto field = simulation.field();
+                JobFrame frame{
+                    .tick = info.tick,
+                    .n = (uint32_t) field.get_n(),
+                    .m = (uint32_t) field.get_m(),
+                };
+                frame.field.reserve(frame.n * frame.m);
+                for (size_t x = 0; x < frame.n; ++x) {
+                    for (size_t y = 0; y < frame.m; ++y) {
+                        frame.field.push_back(field(x, y));
+                    }
+                }
+                send_message(fd, encode(frame));
+            }
+        });
+    }
+
+    auto start_time = std::chrono::steady_clock::now();
+    JobResult result;
+    result.ticks_done = simulation->step(request.ticks);
+    auto end_time = std::chrono::steady_clock::now();
+
+    result.seconds = std::chrono::duration<double>(end_time - start_time).count();
+    result.snapshot = simulation->snapshot();
+    return result;
+}
+
+void Server::reap(bool all) {
+    for (auto it = connections.begin(); it != connections.end(); ) {
+        if (all || it->done) {
+            it->thread.join();
+            it = connections.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
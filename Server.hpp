@@ -0,0 +1,56 @@
+#pragma once
+
+#include "FluidOptions.hpp"
+#include "Protocol.hpp"
+#include "ThreadPool.hpp"
+
+#include <atomic>
+#include <cstddef>
+#include <list>
+#include <memory>
+#include <string>
+#include <thread>
+
+/// Runs simulation jobs for clients of a Unix socket, see Protocol.hpp.
+///
+/// The worker pool is created once and shared by all jobs, so a job does
+/// not pay for thread creation. Each job is driven by its own connection
+/// thread, which only waits for the tasks of its simulation.
+class Server {
+    public:
+        /// options are the base for each job: tiles, layout of storage and
+        /// so on. Threads and pinning are used for the shared pool.
+        Server(std::string socket_path, const FluidOptions& options);
+
+        ~Server();
+
+        /// Accepts connections until stop() is called
+        void run();
+
+        /// Can be called from a signal handler
+        void stop() {
+            need_to_stop = true;
+        }
+
+    private:
+        struct Connection {
+            int fd;
+            std::thread thread;
+            std::atomic<bool> done = false;
+        };
+
+        void serve(Connection& connection);
+
+        JobResult run_job(int fd, const JobRequest& request);
+
+        /// Joins threads of finished connections
+        void reap(bool all);
+
+        std::string socket_path;
+        FluidOptions options;
+        ThreadPool pool;
+
+        int listen_fd = -1;
+        std::atomic<bool> need_to_stop = false;
+        std::list<Connection> connections;
+};
@@ -0,0 +1,223 @@
+#include "Simulation.hpp"
+
+#include "Fluid.hpp"
+#include "type_list.hpp"
+#include "type_marker.hpp"
+#include "type_markers.hpp"
+#include "type_utils.hpp"
+
+#include <sstream>
+#include <utility>
+
+size_t Simulation::step(size_t ticks_count, bool quiet) {
+    stop_requested = false;
+    for (size_t i = 0; i < ticks_count; ++i) {
+        TickInfo info{
+            .tick = get_tick(),
+            .moved = tick(quiet),
+        };
+        for (const auto& callback : callbacks) {
+            callback(*this, info);
+        }
+        if (is_steady() || stop_requested) {
+            return i + 1;
+        }
+    }
+    return ticks_count;
+}
+
+namespace {
+    using types = type_list<TYPES>;
+    using types_product = product<types, types, types>::type;
+
+    template<typename T>
+    double to_double(const T& x) {
+        return static_cast<double>(x);
+    }
+
+    template<typename T>
+    VelocityCell to_double(const std::array<T, deltas.size()>& v) {
+        VelocityCell ans;
+        for (size_t i = 0; i < v.size(); ++i) {
+            ans[i] = static_cast<double>(v[i]);
+        }
+        return ans;
+    }
+
+    template<typename P_TYPE, typename V_TYPE, typename V_FLOW_TYPE>
+    class SimulationImpl : public Simulation {
+        using fluid_t = Fluid<P_TYPE, V_TYPE, V_FLOW_TYPE>;
+
+        public:
+            SimulationImpl(std::istream& in, const FluidOptions& options)
+              : fluid(in, options)
+            {}
+
+            explicit SimulationImpl(const FluidOptions& options)
+              : fluid(ResumeTag{}, options)
+            {}
+
+            void set_steady_criteria(const SteadyCriteria& criteria) override {
+                fluid.set_steady_criteria(criteria);
+            }
+
+            bool is_steady() const override {
+                return fluid.is_steady();
+            }
+
+            size_t get_tick() const override {
+                return fluid.get_tick();
+            }
+
+            size_t get_n() const override {
+                return fluid.get_n();
+            }
+
+            size_t get_m() const override {
+                return fluid.get_m();
+            }
+
+            GridView<char> field() const override {
+                return view<char>([](const fluid_t& f, size_t x, size_t y) {
+                    return f.get_field()[x][y];
+                });
+            }
+
+            GridView<double> p() const override {
+                return view<double>([](const fluid_t& f, size_t x, size_t y) {
+                    return to_double(f.get_p()[x][y]);
+                });
+            }
+
+            GridView<VelocityCell> velocity() const override {
+                return view<VelocityCell>([](const fluid_t& f, size_t x, size_t y) {
+                    return to_double(f.get_velocity()[x][y]);
+                });
+            }
+
+            GridView<VelocityCell> velocity_flow() const override {
+                return view<VelocityCell>([](const fluid_t& f, size_t x, size_t y) {
+                    return to_double(f.get_velocity_flow(x, y));
+                });
+            }
+
+            FluidSnapshot snapshot() const override {
+                return fluid.snapshot();
+            }
+
+            StateHash state_hash() const override {
+                return fluid.state_hash();
+            }
+
+            const PhaseStats& get_phase_stats() const override {
+                return fluid.get_phase_stats();
+            }
+
+            void fill(size_t x_begin, size_t y_begin, size_t x_end, size_t y_end, char c) override {
+                fluid.fill(x_begin, y_begin, x_end, y_end, c);
+            }
+
+            void set_g(double value) override {
+                fluid.set_g(value);
+            }
+
+            void set_rho(char c, double value) override {
+                fluid.set_rho(c, value);
+            }
+
+            void checkpoint() override {
+                fluid.checkpoint();
+            }
+
+            void follow() override {
+                fluid.follow();
+            }
+
+            std::array<std::string_view, 3> type_names() const override {
+                return {
+                    get_type_name<P_TYPE>(),
+                    get_type_name<V_TYPE>(),
+                    get_type_name<V_FLOW_TYPE>(),
+                };
+            }
+
+        protected:
+            bool tick(bool quiet) override {
+                return fluid.step(quiet);
+            }
+
+        private:
+            fluid_t fluid;
+
+            /// Getters are captureless lambdas, so they decay to plain
+            /// function pointers
+            template<typename T, typename F>
+            GridView<T> view(F) const {
+                return GridView<T>(
+                    &fluid,
+                    fluid.get_n(),
+                    fluid.get_m(),
+                    [](const void* source, size_t x, size_t y) -> T {
+                        return F{}(*static_cast<const fluid_t*>(source), x, y);
+                    }
+                );
+            }
+    };
+
+    /// Resumes from a checkpoint, if there is no scenario
+    struct simulation_factory {
+        std::istream* in;
+        const FluidOptions& options;
+        std::unique_ptr<Simulation> result = nullptr;
+
+        template<typename P_TYPE, typename V_TYPE, typename V_FLOW_TYPE>
+        void run() {
+            if (in != nullptr) {
+                result = std::make_unique<SimulationImpl<P_TYPE, V_TYPE, V_FLOW_TYPE>>(*in, options);
+            } else {
+                result = std::make_unique<SimulationImpl<P_TYPE, V_TYPE, V_FLOW_TYPE>>(options);
+            }
+        }
+    };
+
+    struct types_collector {
+        std::vector<SimulationTypes> result;
+
+        template<is_type_marker P, is_type_marker V, is_type_marker VF>
+        void run() {
+            result.push_back({P{}.name(), V{}.name(), VF{}.name()});
+        }
+    };
+}
+
+std::unique_ptr<Simulation> Simulation::create(
+    std::string_view scenario,
+    const SimulationTypes& types,
+    const FluidOptions& options
+) {
+    std::stringstream ss{std::string(scenario)};
+    simulation_factory factory{&ss, options};
+    run_for_matching<simulation_factory, types_product>{}(
+        factory,
+        {types.p_type, types.v_type, types.v_flow_type}
+    );
+    return std::move(factory.result);
+}
+
+std::unique_ptr<Simulation> Simulation::resume(
+    const SimulationTypes& types,
+    const FluidOptions& options
+) {
+    simulation_factory factory{nullptr, options};
+    run_for_matching<simulation_factory, types_product>{}(
+        factory,
+        {types.p_type, types.v_type, types.v_flow_type}
+    );
+    return std::move(factory.result);
+}
+
+std::vector<SimulationTypes> Simulation::compiled_types() {
+    types_collector collector;
+    run_for_all<types_collector, types_product>{}(collector);
+    return std::move(collector.result);
+}
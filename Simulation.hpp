@@ -0,0 +1,159 @@
+#pragma once
+
+#include "FluidOptions.hpp"
+#include "FluidSnapshot.hpp"
+#include "PhaseStats.hpp"
+#include "StateHash.hpp"
+#include "SteadyState.hpp"
+#include "const.hpp"
+
+#include <array>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/// Read-only view of an n x m grid of a simulation. Nothing is copied: each
+/// access reads the storage of the simulation and converts the value to T,
+/// so the view always shows the current state. It is valid as long as the
+/// simulation is alive, but must not be read during a step.
+template<typename T>
+class GridView {
+    public:
+        using getter_t = T (*)(const void* source, size_t x, size_t y);
+
+        GridView(const void* source, size_t n, size_t m, getter_t getter)
+          : source(source),
+            n(n),
+            m(m),
+            getter(getter)
+        {}
+
+        size_t get_n() const {
+            return n;
+        }
+
+        size_t get_m() const {
+            return m;
+        }
+
+        T operator()(size_t x, size_t y) const {
+            return getter(source, x, y);
+        }
+
+    private:
+        const void* source;
+        size_t n, m;
+        getter_t getter;
+};
+
+using VelocityCell = std::array<double, deltas.size()>;
+
+/// Names of p, v and v-flow types in the spelling of --p-type and friends,
+/// e.g. "fixed(32,16)"
+struct SimulationTypes {
+    std::string p_type;
+    std::string v_type;
+    std::string v_flow_type;
+};
+
+struct TickInfo {
+    /// Number of the tick, starting from 0
+    size_t tick;
+    /// Some particle has moved during the tick
+    bool moved;
+};
+
+/// Fluid with types, that are chosen at runtime among the compiled TYPES.
+/// Is the entry point for embedding: a process may drive any number of
+/// simulations, each has its own thread pool and random generator.
+class Simulation {
+    public:
+        /// Is called after each tick of step
+        using TickCallback = std::function<void(const Simulation&, const TickInfo&)>;
+
+        /// Loads scenario from its text (in the format of data.in). Throws,
+        /// if the triple of types is not compiled.
+        static std::unique_ptr<Simulation> create(
+            std::string_view scenario,
+            const SimulationTypes& types,
+            const FluidOptions& options = {}
+        );
+
+        /// Resumes from the checkpoint in options.storage_file, that was left
+        /// by a simulation with Storage::FILE of the same types
+        static std::unique_ptr<Simulation> resume(
+            const SimulationTypes& types,
+            const FluidOptions& options
+        );
+
+        /// All compiled triples of types
+        static std::vector<SimulationTypes> compiled_types();
+
+        virtual ~Simulation() = default;
+
+        /// Makes up to ticks_count ticks, stops after the tick, that reaches
+        /// the steady state (see set_steady_criteria) or after request_stop.
+        /// Returns the number of ticks made. If not quiet, the field is
+        /// printed after each move.
+        size_t step(size_t ticks_count = 1, bool quiet = true);
+
+        void on_tick(TickCallback callback) {
+            callbacks.push_back(std::move(callback));
+        }
+
+        /// Makes the current step return after the current tick, e.g. from a
+        /// callback
+        void request_stop() {
+            stop_requested = true;
+        }
+
+        /// The last step was stopped by request_stop
+        bool is_stop_requested() const {
+            return stop_requested;
+        }
+
+        virtual void set_steady_criteria(const SteadyCriteria& criteria) = 0;
+        virtual bool is_steady() const = 0;
+
+        /// Number of ticks made
+        virtual size_t get_tick() const = 0;
+        virtual size_t get_n() const = 0;
+        virtual size_t get_m() const = 0;
+
+        virtual GridView<char> field() const = 0;
+        virtual GridView<double> p() const = 0;
+        virtual GridView<VelocityCell> velocity() const = 0;
+        virtual GridView<VelocityCell> velocity_flow() const = 0;
+
+        virtual FluidSnapshot snapshot() const = 0;
+        virtual StateHash state_hash() const = 0;
+        virtual const PhaseStats& get_phase_stats() const = 0;
+
+        /// Edits between steps, see Fluid::fill. Throw with slabs.
+        virtual void fill(size_t x_begin, size_t y_begin, size_t x_end, size_t y_end, char c) = 0;
+        virtual void set_g(double value) = 0;
+        virtual void set_rho(char c, double value) = 0;
+
+        /// Runs a follower process of FluidOptions::slabs: makes ticks along
+        /// with the leader (the process, that calls step), until the leader
+        /// is destroyed
+        virtual void follow() = 0;
+
+        /// Makes the file of Storage::FILE a checkpoint of the current tick,
+        /// throws with other storages
+        virtual void checkpoint() = 0;
+
+        /// C++ names of p, v and v-flow types
+        virtual std::array<std::string_view, 3> type_names() const = 0;
+
+    protected:
+        /// Returns true, if some particle has moved
+        virtual bool tick(bool quiet) = 0;
+
+    private:
+        std::vector<TickCallback> callbacks;
+        bool stop_requested = false;
+};
@@ -0,0 +1,167 @@
+#include "Slabs.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <string>
+
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+namespace {
+    /// How often waiters of barrier check, if some process has failed
+    constexpr long FAIL_CHECK_NS = 100'000'000;
+
+    /// Futexes are shared (no FUTEX_PRIVATE_FLAG), as the word is in memory
+    /// of several processes
+    void futex_wait(std::atomic<uint32_t>& word, uint32_t expected) {
+        timespec timeout{.tv_sec = 0, .tv_nsec = FAIL_CHECK_NS};
+        syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAIT, expected, &timeout, nullptr, 0);
+    }
+
+    void futex_wake_all(std::atomic<uint32_t>& word) {
+        syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+    }
+
+    std::string segment_name(pid_t leader_pid, uint32_t segment) {
+        return "/fluid-" + std::to_string(leader_pid) + "-" + std::to_string(segment);
+    }
+}
+
+SlabGroup::SlabGroup(size_t processes)
+  : processes(processes),
+    leader_pid(getpid())
+{
+    static_assert(std::atomic<uint32_t>::is_always_lock_free);
+    if (processes == 0) {
+        throw std::runtime_error("number of processes should be positive");
+    }
+    // Is inherited by the followers on fork
+    void* ptr = mmap(nullptr, sizeof(Control), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (ptr == MAP_FAILED) {
+        throw std::runtime_error("failed to map control block of slab group");
+    }
+    control = new (ptr) Control{};
+}
+
+SlabGroup::~SlabGroup() {
+    join();
+    munmap(control, sizeof(Control));
+}
+
+size_t SlabGroup::launch() {
+    for (size_t r = 1; r < processes; ++r) {
+        pid_t pid = fork();
+        if (pid < 0) {
+            fail();
+            throw std::runtime_error(std::string("fork failed: ") + std::strerror(errno));
+        }
+        if (pid == 0) {
+            rank = r;
+            followers.clear();
+            return rank;
+        }
+        followers.push_back(pid);
+    }
+    return 0;
+}
+
+void SlabGroup::barrier() {
+    uint32_t generation = control->generation.load(std::memory_order_acquire);
+    if (control->arrived.fetch_add(1, std::memory_order_acq_rel) + 1 == processes) {
+        control->arrived.store(0, std::memory_order_relaxed);
+        control->generation.fetch_add(1, std::memory_order_release);
+        futex_wake_all(control->generation);
+        return;
+    }
+    while (control->generation.load(std::memory_order_acquire) == generation) {
+        bool failed = control->failed.load(std::memory_order_relaxed);
+        // A follower may exit right after the last barrier is passed
+        if (!failed && !peers_alive()) {
+            failed = control->generation.load(std::memory_order_acquire) == generation;
+        }
+        if (failed) {
+            fail();
+            throw std::runtime_error("a process of the slab group has failed");
+        }
+        futex_wait(control->generation, generation);
+    }
+}
+
+bool SlabGroup::peers_alive() const {
+    if (!is_leader()) {
+        // A killed leader does not reach fail, the follower is reparented
+        return getppid() == leader_pid;
+    }
+    for (pid_t pid : followers) {
+        // Is not reaped, join collects the status
+        siginfo_t info{};
+        if (waitid(P_PID, pid, &info, WEXITED | WNOHANG | WNOWAIT) == 0 && info.si_pid == pid) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool SlabGroup::broadcast(bool value) {
+    if (is_leader()) {
+        control->value = value;
+    }
+    barrier();
+    bool ans = control->value;
+    // The leader may not overwrite the value, until all have read it
+    barrier();
+    return ans;
+}
+
+void SlabGroup::fail() {
+    control->failed.store(1, std::memory_order_relaxed);
+    futex_wake_all(control->generation);
+}
+
+PageBuffer SlabGroup::map_data(size_t bytes) {
+    auto name = segment_name(leader_pid, control->segments);
+    PageBuffer buffer;
+    if (is_leader()) {
+        buffer = PageBuffer::map_shm(name, bytes, true);
+    }
+    barrier();
+    if (!is_leader()) {
+        buffer = PageBuffer::map_shm(name, bytes, false);
+    }
+    barrier();
+    if (is_leader()) {
+        // All have mapped it, the name is not needed any more, and the
+        // segment goes away with the last mapping
+        shm_unlink(name.c_str());
+        ++control->segments;
+    }
+    barrier();
+    return buffer;
+}
+
+std::pair<size_t, size_t> SlabGroup::slab(size_t n, size_t tile_n) const {
+    size_t tile_rows = (n + tile_n - 1) / tile_n;
+    size_t begin = rank * tile_rows / processes * tile_n;
+    size_t end = (rank + 1) * tile_rows / processes * tile_n;
+    return {std::min(n, begin), std::min(n, end)};
+}
+
+bool SlabGroup::join() {
+    bool ok = true;
+    for (pid_t pid : followers) {
+        int status;
+        if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            ok = false;
+        }
+    }
+    followers.clear();
+    return ok;
+}
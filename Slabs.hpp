@@ -0,0 +1,103 @@
+#pragma once
+
+#include "Memory.hpp"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include <sys/types.h>
+
+/// Processes of a single simulation on one machine: each of them runs the
+/// parallel phases over its own slab of rows (domain decomposition), so a
+/// simulation may span several processes, e.g. one per NUMA node.
+///
+/// All matrices live in a single POSIX shared memory segment (see map_data),
+/// so halo rows of neighbouring slabs are read in place instead of being
+/// copied. Phases are separated by barrier(): each pass of the scheduler
+/// ends with it, so tiles of a color are done in all slabs before the next
+/// color starts, the same as with threads of a single process. Global phases
+/// (recalc_flow and maybe_propagate follow paths across the whole grid) are
+/// run by the leader (rank 0) alone, while the rest wait, so results and the
+/// random sequence match a single process.
+///
+/// So slabs only speed up the local phases, forces and recalc_p. Where most
+/// time goes to path search, e.g. recalc_flow takes 98% of a tick of
+/// data_heavy.in, more processes give no speedup. That would need slab-local
+/// path search, that hands paths off to the neighbouring slab at the
+/// boundary.
+class SlabGroup {
+    public:
+        /// Maps the control block, no processes are started yet
+        explicit SlabGroup(size_t processes);
+
+        SlabGroup(const SlabGroup&) = delete;
+        SlabGroup& operator=(const SlabGroup&) = delete;
+
+        /// The leader waits for the followers
+        ~SlabGroup();
+
+        /// Forks processes - 1 followers and returns the rank of the calling
+        /// process, 0 in the leader. Must be called before any thread is
+        /// started, as threads do not survive fork.
+        size_t launch();
+
+        size_t get_rank() const {
+            return rank;
+        }
+
+        size_t size() const {
+            return processes;
+        }
+
+        bool is_leader() const {
+            return rank == 0;
+        }
+
+        /// Waits until all processes reach it. Throws, if some process has
+        /// failed or has been killed, so that the rest do not wait forever.
+        void barrier();
+
+        /// Returns value of the leader in all processes
+        bool broadcast(bool value);
+
+        /// Marks the group as failed, the rest throw from barrier
+        void fail();
+
+        /// Maps a shared segment of bytes in all processes: the leader
+        /// creates it, the rest open it by name. Must be called by all
+        /// processes in the same order.
+        PageBuffer map_data(size_t bytes);
+
+        /// Rows [begin, end) of this process: whole rows of tiles of tile_n
+        /// are split evenly
+        std::pair<size_t, size_t> slab(size_t n, size_t tile_n) const;
+
+        /// Waits for the followers to exit (in the leader only). Returns
+        /// false, if some of them has failed.
+        bool join();
+
+    private:
+        struct Control {
+            std::atomic<uint32_t> arrived;
+            /// Futex word, is incremented, when all processes have arrived
+            std::atomic<uint32_t> generation;
+            std::atomic<uint32_t> failed;
+            /// Value of broadcast
+            bool value;
+            /// Number of segments created by map_data
+            uint32_t segments;
+        };
+
+        /// Checks, that the processes, that this one can see, are running,
+        /// so that a killed process does not leave the rest waiting
+        bool peers_alive() const;
+
+        Control* control = nullptr;
+        size_t processes;
+        size_t rank = 0;
+        pid_t leader_pid;
+        std::vector<pid_t> followers;
+};
@@ -0,0 +1,86 @@
+#include "StateHash.hpp"
+
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <ostream>
+#include <sstream>
+#include <stdexcept>
+
+void write_hash_header(std::ostream& out, const StateHash& hash) {
+    out << "hash " << hash.n << " " << hash.m << " " << StateHash::BLOCK << "\n";
+}
+
+void write_hash(std::ostream& out, size_t tick, const StateHash& hash) {
+    out << tick << std::hex << std::setfill('0');
+    out << " " << std::setw(16) << hash.total;
+    for (uint64_t block : hash.blocks) {
+        out << " " << std::setw(16) << block;
+    }
+    out << std::dec << std::setfill(' ') << "\n";
+}
+
+HashChecker::HashChecker(const std::string& filename) {
+    std::ifstream fin(filename);
+    if (!fin) {
+        throw std::runtime_error("failed to open hash log");
+    }
+
+    std::string magic;
+    size_t block;
+    if (!(fin >> magic >> n >> m >> block) || magic != "hash") {
+        throw std::runtime_error("wrong hash log header");
+    }
+    if (block != StateHash::BLOCK) {
+        throw std::runtime_error("hash log has another block size");
+    }
+
+    std::string line;
+    std::getline(fin, line);
+    while (std::getline(fin, line)) {
+        if (line.empty()) {
+            continue;
+        }
+        std::stringstream ss(line);
+        size_t tick;
+        StateHash hash(n, m);
+        ss >> tick >> std::hex >> hash.total;
+        for (auto& h : hash.blocks) {
+            ss >> h;
+        }
+        if (!ss) {
+            throw std::runtime_error("wrong hash log line");
+        }
+        recorded[tick] = std::move(hash);
+    }
+}
+
+std::optional<std::string> HashChecker::check(size_t tick, const StateHash& hash) const {
+    auto it = recorded.find(tick);
+    if (it == recorded.end()) {
+        return std::nullopt;
+    }
+    const auto& expected = it->second;
+
+    std::stringstream ss;
+    if (hash.n != n || hash.m != m) {
+        ss << "field size differs from the log: " << hash.n << "x" << hash.m << " vs " << n << "x" << m;
+        return ss.str();
+    }
+    if (hash.total == expected.total) {
+        return std::nullopt;
+    }
+
+    ss << "hash diverged at tick " << tick;
+    for (size_t i = 0; i < hash.blocks.size(); ++i) {
+        if (hash.blocks[i] != expected.blocks[i]) {
+            size_t bx = i / hash.blocks_m() * StateHash::BLOCK;
+            size_t by = i % hash.blocks_m() * StateHash::BLOCK;
+            ss << ", block " << i
+               << " (rows " << bx << ".." << std::min(n, bx + StateHash::BLOCK) - 1
+               << ", cols " << by << ".." << std::min(m, by + StateHash::BLOCK) - 1 << ")";
+            break;
+        }
+    }
+    return ss.str();
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <iosfwd>
+#include <map>
+#include <optional>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+/// Zobrist-style hash of the state: each (cell, component, value) gets an
+/// independent pseudo-random key and the keys are XORed together. Keys are
+/// computed by a mixing function instead of a table, so the hash does not
+/// depend on the size of the grid in memory.
+///
+/// The grid is split into BLOCK x BLOCK blocks, each block is hashed
+/// separately (in parallel) and the total is the XOR of blocks, so that a
+/// divergence can be narrowed down to a block. Blocks do not depend on tiles
+/// of the scheduler, so runs with different tiles or threads are comparable.
+struct StateHash {
+    static constexpr size_t BLOCK = 16;
+
+    size_t n = 0, m = 0;
+    uint64_t total = 0;
+    /// Row-major, blocks_n() x blocks_m()
+    std::vector<uint64_t> blocks;
+
+    StateHash() = default;
+    StateHash(size_t n, size_t m)
+      : n(n),
+        m(m),
+        blocks(blocks_n() * blocks_m())
+    {}
+
+    size_t blocks_n() const {
+        return (n + BLOCK - 1) / BLOCK;
+    }
+
+    size_t blocks_m() const {
+        return (m + BLOCK - 1) / BLOCK;
+    }
+
+    /// Component of a cell, that is hashed
+    enum Component : uint64_t {
+        FIELD,
+        P,
+        VELOCITY,
+    };
+
+    /// Key of a single value, index distinguishes e.g. directions of velocity
+    static uint64_t key(size_t x, size_t y, Component component, size_t index, uint64_t bits) {
+        uint64_t position = ((uint64_t) x << 40) ^ ((uint64_t) y << 16) ^ ((uint64_t) component << 8) ^ index;
+        return mix(position ^ mix(bits));
+    }
+
+    /// Bits of the stored representation, so that hashes of float and
+    /// fixed types are bit-exact
+    template<typename T>
+    requires std::is_trivially_copyable_v<T>
+    static uint64_t raw_bits(const T& x) {
+        static_assert(sizeof(T) <= sizeof(uint64_t));
+        uint64_t bits = 0;
+        std::memcpy(&bits, &x, sizeof(T));
+        return bits;
+    }
+
+    private:
+        /// Finalizer of splitmix64
+        static uint64_t mix(uint64_t x) {
+            x ^= x >> 30;
+            x *= 0xbf58476d1ce4e5b9;
+            x ^= x >> 27;
+            x *= 0x94d049bb133111eb;
+            x ^= x >> 31;
+            return x;
+        }
+};
+
+/// Text log of hashes: a header "hash N M BLOCK", then a line per hashed
+/// tick: the tick, the total and all blocks in hex
+void write_hash_header(std::ostream& out, const StateHash& hash);
+void write_hash(std::ostream& out, size_t tick, const StateHash& hash);
+
+/// Compares hashes of a run with a recorded log
+class HashChecker {
+    public:
+        explicit HashChecker(const std::string& filename);
+
+        /// Returns description of the divergence: the tick and the first
+        /// block, that differs. Ticks, that are not in the log, are skipped.
+        std::optional<std::string> check(size_t tick, const StateHash& hash) const;
+
+    private:
+        size_t n = 0, m = 0;
+        std::map<size_t, StateHash> recorded;
+};
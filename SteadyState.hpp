@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstddef>
+#include <limits>
+
+/// Convergence criteria for early termination of Fluid::run.
+/// The run is considered steady when all criteria hold at once.
+struct SteadyCriteria {
+    /// Number of consecutive ticks without a single successful move.
+    /// Zero disables steady-state detection.
+    size_t still_ticks = 0;
+
+    /// Upper bound for max |p(t) - p(t - 1)| over all cells
+    double max_dp = std::numeric_limits<double>::infinity();
+
+    /// Upper bound for total kinetic energy: sum of rho * v^2 / 2 over all
+    /// cells and directions
+    double max_energy = std::numeric_limits<double>::infinity();
+
+    bool enabled() const {
+        return still_ticks > 0;
+    }
+};
+
+/// Values, collected during the tick, that are checked against SteadyCriteria
+struct SteadyState {
+    size_t still_ticks = 0;
+    double max_dp = std::numeric_limits<double>::infinity();
+    double energy = std::numeric_limits<double>::infinity();
+
+    bool satisfies(const SteadyCriteria& criteria) const {
+        return criteria.enabled()
+            && still_ticks >= criteria.still_ticks
+            && max_dp <= criteria.max_dp
+            && energy <= criteria.max_energy;
+    }
+};
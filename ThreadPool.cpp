@@ -1,12 +1,163 @@
 #include "ThreadPool.hpp"
 
+#include <algorithm>
 #include <format>
+#include <fstream>
 #include <iostream>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <utility>
 
-ThreadPool::ThreadPool(size_t threads_count) {
+#include <pthread.h>
+#include <sched.h>
+
+namespace {
+    /// CPUs, that this process is allowed to run on
+    std::vector<size_t> allowed_cpus() {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        if (sched_getaffinity(0, sizeof(set), &set) != 0) {
+            throw std::runtime_error("sched_getaffinity failed");
+        }
+        std::vector<size_t> cpus;
+        for (size_t cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+            if (CPU_ISSET(cpu, &set)) {
+                cpus.push_back(cpu);
+            }
+        }
+        return cpus;
+    }
+
+    /// Reads /sys/devices/system/cpu/cpuN/topology/<name>, 0 if unavailable
+    size_t cpu_topology(size_t cpu, const std::string& name) {
+        std::ifstream fin("/sys/devices/system/cpu/cpu" + std::to_string(cpu) + "/topology/" + name);
+        size_t value = 0;
+        fin >> value;
+        return value;
+    }
+}
+
+ThreadPinning ThreadPinning::parse(const std::string& s) {
+    if (s == "none") {
+        return {};
+    }
+    if (s == "compact") {
+        return ThreadPinning { .policy = Policy::COMPACT };
+    }
+    if (s == "scatter") {
+        return ThreadPinning { .policy = Policy::SCATTER };
+    }
+
+    ThreadPinning ans { .policy = Policy::LIST };
+    std::stringstream ss(s);
+    std::string cpu;
+    while (std::getline(ss, cpu, ',')) {
+        size_t pos = 0;
+        ans.cpus.push_back(std::stoul(cpu, &pos));
+        if (pos != cpu.size()) {
+            throw std::runtime_error("wrong cpu list");
+        }
+        // cpu_set_t has no bits for them
+        if (ans.cpus.back() >= CPU_SETSIZE) {
+            throw std::runtime_error("cpu " + cpu + " is out of range");
+        }
+    }
+    if (ans.cpus.empty()) {
+        throw std::runtime_error("empty cpu list");
+    }
+    return ans;
+}
+
+std::vector<size_t> ThreadPinning::assign(size_t threads_count) const {
+    std::vector<size_t> order;
+    switch (policy) {
+        case Policy::NONE:
+            return {};
+
+        case Policy::LIST:
+            order = cpus;
+            break;
+
+        case Policy::COMPACT:
+        case Policy::SCATTER: {
+            // package -> core -> cpus
+            std::map<size_t, std::map<size_t, std::vector<size_t>>> topology;
+            for (size_t cpu : allowed_cpus()) {
+                topology[cpu_topology(cpu, "physical_package_id")][cpu_topology(cpu, "core_id")].push_back(cpu);
+            }
+
+            if (policy == Policy::COMPACT) {
+                for (const auto& [package, cores] : topology) {
+                    for (const auto& [core, core_cpus] : cores) {
+                        order.insert(order.end(), core_cpus.begin(), core_cpus.end());
+                    }
+                }
+            } else {
+                // Round-robin over packages, then over cores, then over
+                // hyperthreads of a core
+                std::vector<std::vector<std::vector<size_t>>> packages;
+                for (const auto& [package, cores] : topology) {
+                    auto& package_cores = packages.emplace_back();
+                    for (const auto& [core, core_cpus] : cores) {
+                        package_cores.push_back(core_cpus);
+                    }
+                }
+                for (size_t smt = 0; ; ++smt) {
+                    size_t added = 0;
+                    for (size_t core = 0; ; ++core) {
+                        bool any_core = false;
+                        for (const auto& package_cores : packages) {
+                            if (core >= package_cores.size()) {
+                                continue;
+                            }
+                            any_core = true;
+                            if (smt < package_cores[core].size()) {
+                                order.push_back(package_cores[core][smt]);
+                                ++added;
+                            }
+                        }
+                        if (!any_core) {
+                            break;
+                        }
+                    }
+                    if (added == 0) {
+                        break;
+                    }
+                }
+            }
+            break;
+        }
+    }
+
+    std::vector<size_t> ans(threads_count);
+    for (size_t i = 0; i < threads_count; ++i) {
+        ans[i] = order[i % order.size()];
+    }
+    return ans;
+}
+
+ThreadPool::ThreadPool(size_t threads_count, const ThreadPinning& pinning) {
+    if (threads_count == 0) {
+        throw std::runtime_error("threads count should be positive");
+    }
+
+    auto cpus = pinning.assign(threads_count);
+
+    thread_queues.resize(threads_count);
+    thread_stats = std::make_unique<ThreadStats[]>(threads_count);
     threads.reserve(threads_count);
     for (size_t thread_num = 0; thread_num < threads_count; ++thread_num) {
         threads.emplace_back(&ThreadPool::run, this, thread_num);
+
+        if (!cpus.empty()) {
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(cpus[thread_num], &set);
+            if (pthread_setaffinity_np(threads.back().native_handle(), sizeof(set), &set) != 0) {
+                std::cerr << "Failed to pin thread " << thread_num << " to cpu " << cpus[thread_num] << std::endl;
+            }
+        }
     }
     free_threads = threads_count;
 }
@@ -47,21 +198,60 @@ void ThreadPool::wait_all() {
     });
 }
 
+size_t ThreadPool::threads_count() const {
+    return threads.size();
+}
+
+void ThreadPool::add_group_task(TaskGroup* group, size_t thread_num, std::function<void()> func) {
+    std::lock_guard<std::mutex> tasks_queue_lock(tasks_queue_mtx);
+    Task task {
+        .id = 0,
+        .func = std::move(func),
+        .group = group,
+    };
+    queued.fetch_add(1, std::memory_order_relaxed);
+    if (thread_num < threads.size()) {
+        thread_queues[thread_num].push(std::move(task));
+        task_added_cv.notify_all();
+    } else {
+        tasks_queue.push(std::move(task));
+        task_added_cv.notify_one();
+    }
+}
+
 void ThreadPool::run(size_t thread_num) {
+    auto& stats = thread_stats[thread_num];
+    auto add = [](std::atomic<uint64_t>& counter, uint64_t value) {
+        // The only writer, no read-modify-write is needed
+        counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+    };
+
     while (!need_to_quit) {
+        auto idle_start = std::chrono::steady_clock::now();
         std::unique_lock<std::mutex> tasks_queue_lock(tasks_queue_mtx);
-        task_added_cv.wait(tasks_queue_lock, [this]{
-            return need_to_quit || !tasks_queue.empty();
+        auto& own_queue = thread_queues[thread_num];
+        task_added_cv.wait(tasks_queue_lock, [this, &own_queue]{
+            return need_to_quit || !tasks_queue.empty() || !own_queue.empty();
         });
+        add(stats.idle_ns, std::chrono::nanoseconds(std::chrono::steady_clock::now() - idle_start).count());
 
         --free_threads;
         if (need_to_quit) break;
 
-        auto task = std::move(tasks_queue.front());
-        tasks_queue.pop();
+        auto& queue = own_queue.empty() ? tasks_queue : own_queue;
+        auto task = std::move(queue.front());
+        queue.pop();
+        queued.fetch_sub(1, std::memory_order_relaxed);
         tasks_queue_lock.unlock();
 
         task.func();
+        add(stats.tasks, 1);
+
+        if (task.group != nullptr) {
+            ++free_threads;
+            task.group->task_done();
+            continue;
+        }
 
         std::lock_guard<std::mutex> done_task_ids_lock(done_task_ids_mtx);
         done_task_ids.insert(task.id);
@@ -71,3 +261,17 @@ void ThreadPool::run(size_t thread_num) {
         task_done_cv.notify_one();
     }
 }
+
+void TaskGroup::wait() {
+    std::unique_lock<std::mutex> lock(mtx);
+    done_cv.wait(lock, [this]{
+        return pending == 0;
+    });
+}
+
+void TaskGroup::task_done() {
+    std::lock_guard<std::mutex> lock(mtx);
+    if (--pending == 0) {
+        done_cv.notify_all();
+    }
+}
@@ -1,26 +1,68 @@
 #pragma once
 
+#include <algorithm>
 #include <atomic>
+#include <chrono>
 #include <condition_variable>
 #include <cstddef>
+#include <cstdint>
 #include <functional>
+#include <memory>
 #include <mutex>
 #include <queue>
+#include <string>
 #include <thread>
 #include <unordered_set>
 #include <vector>
 
 using task_id_t = size_t;
 
+/// Number of hardware threads, hardware_concurrency may be 0, if it is not
+/// known
+inline size_t default_threads_count() {
+    return std::max(1u, std::thread::hardware_concurrency());
+}
+
+/// Binding of pool threads to CPUs
+struct ThreadPinning {
+    enum class Policy {
+        /// Threads are not pinned
+        NONE,
+        /// Fill CPUs of one socket before moving to the next one
+        COMPACT,
+        /// Put consecutive threads on different sockets and cores
+        SCATTER,
+        /// Thread i is pinned to cpus[i % cpus.size()]
+        LIST,
+    };
+
+    Policy policy = Policy::NONE;
+    std::vector<size_t> cpus;
+
+    /// Parses "compact", "scatter", "none" or a comma-separated CPU list
+    static ThreadPinning parse(const std::string& s);
+
+    /// CPU for each of threads_count threads, empty for Policy::NONE
+    std::vector<size_t> assign(size_t threads_count) const;
+};
+
+class TaskGroup;
+
 class ThreadPool {
     private:
         struct Task {
             task_id_t id;
             std::function<void()> func;
+            /// Tasks of a group are not given ids and are not put into
+            /// done_task_ids, the group counts them instead
+            TaskGroup* group = nullptr;
         };
 
     public:
-        ThreadPool(size_t threads_count = std::thread::hardware_concurrency());
+        ThreadPool(
+            size_t threads_count = default_threads_count(),
+            const ThreadPinning& pinning = {}
+        );
 
         ~ThreadPool();
 
@@ -34,10 +76,26 @@ class ThreadPool {
                 .id = id,
                 .func = std::bind(f, args...),
             });
+            queued.fetch_add(1, std::memory_order_relaxed);
             task_added_cv.notify_one();
             return id;
         }
 
+        /// Same as add_task, but the task is run by the thread thread_num.
+        /// Is used to keep data owned by the same thread across phases.
+        template<typename F, typename... Args>
+        task_id_t add_task_for(size_t thread_num, const F& f, Args&&... args) {
+            std::lock_guard<std::mutex> tasks_queue_lock(tasks_queue_mtx);
+            task_id_t id = next_task_id++;
+            thread_queues[thread_num].push(Task {
+                .id = id,
+                .func = std::bind(f, args...),
+            });
+            queued.fetch_add(1, std::memory_order_relaxed);
+            task_added_cv.notify_all();
+            return id;
+        }
+
         template<typename F, typename... Args>
         task_id_t add_task_now(const F& f, Args&&... args) {
             std::unique_lock<std::mutex> tasks_queue_lock(tasks_queue_mtx);
@@ -47,6 +105,7 @@ class ThreadPool {
                     .id = id,
                     .func = std::bind(f, args...),
                 });
+                queued.fetch_add(1, std::memory_order_relaxed);
                 task_added_cv.notify_one();
             } else {
                 tasks_queue_lock.unlock();
@@ -61,10 +120,39 @@ class ThreadPool {
 
         void wait_all();
 
+        size_t threads_count() const;
+
+        /// Tasks, that wait for a thread. Is read without locks, e.g. by a
+        /// metrics exporter.
+        size_t queue_depth() const {
+            return queued.load(std::memory_order_relaxed);
+        }
+
+        /// Time, that the thread has spent waiting for tasks
+        std::chrono::duration<double> idle_time(size_t thread_num) const {
+            return std::chrono::nanoseconds(thread_stats[thread_num].idle_ns.load(std::memory_order_relaxed));
+        }
+
+        size_t tasks_done(size_t thread_num) const {
+            return thread_stats[thread_num].tasks.load(std::memory_order_relaxed);
+        }
+
     private:
+        /// Written by its thread only, on its own cache line
+        struct alignas(64) ThreadStats {
+            std::atomic<uint64_t> idle_ns = 0;
+            std::atomic<uint64_t> tasks = 0;
+        };
+
+        friend class TaskGroup;
+
+        /// thread_num == threads_count() means any thread
+        void add_group_task(TaskGroup* group, size_t thread_num, std::function<void()> func);
+
         void run(size_t thread_num);
 
         std::queue<Task> tasks_queue;
+        std::vector<std::queue<Task>> thread_queues;
         std::mutex tasks_queue_mtx;
 
         std::vector<std::thread> threads;
@@ -75,7 +163,59 @@ class ThreadPool {
         std::atomic<task_id_t> next_task_id = 0;
         std::atomic<bool> need_to_quit = false;
         std::atomic<size_t> free_threads;
+        std::atomic<size_t> queued = 0;
+        std::unique_ptr<ThreadStats[]> thread_stats;
 
         std::condition_variable task_done_cv;
         std::condition_variable task_added_cv;
 };
+
+/// Tasks, that are waited for together. Several groups may share a pool:
+/// each waits only for its own tasks, so independent simulations can run on
+/// the same threads. Unlike wait_all of the pool, a group keeps no per-task
+/// state after the task is done.
+class TaskGroup {
+    public:
+        explicit TaskGroup(ThreadPool& pool)
+          : pool(pool)
+        {}
+
+        TaskGroup(const TaskGroup&) = delete;
+        TaskGroup& operator=(const TaskGroup&) = delete;
+
+        ~TaskGroup() {
+            wait();
+        }
+
+        template<typename F>
+        void add_task(const F& f) {
+            add_task_for(pool.threads_count(), f);
+        }
+
+        /// Same as ThreadPool::add_task_for
+        template<typename F>
+        void add_task_for(size_t thread_num, const F& f) {
+            {
+                std::lock_guard<std::mutex> lock(mtx);
+                ++pending;
+            }
+            pool.add_group_task(this, thread_num, f);
+        }
+
+        /// Waits until all tasks of the group are done
+        void wait();
+
+        ThreadPool& get_pool() {
+            return pool;
+        }
+
+    private:
+        friend class ThreadPool;
+
+        void task_done();
+
+        ThreadPool& pool;
+        size_t pending = 0;
+        std::mutex mtx;
+        std::condition_variable done_cv;
+};
@@ -1,5 +1,6 @@
 #pragma once
 
+#include "Epoch.hpp"
 #include "Matrix.hpp"
 #include "const.hpp"
 
@@ -16,23 +17,86 @@ struct VectorField {
       : v(nullptr)
     {}
 
-    VectorField(size_t n, size_t m)
-      : v(create_matrix<std::array<T, deltas.size()>>{}(n, m))
+    VectorField(size_t n, size_t m, const MatrixOptions& options = {})
+      : v(create_matrix<std::array<T, deltas.size()>>{}(n, m, options))
+    {}
+
+    /// Takes ownership of the matrix
+    explicit VectorField(AbstractMatrix<std::array<T, deltas.size()>>* v)
+      : v(v)
     {}
 
     void reset() {
         v->reset();
     }
 
-    T& add(int x, int y, int dx, int dy, T dv) {
+    template<typename U>
+    T& add(int x, int y, int dx, int dy, U dv) {
         assert(v.get() != nullptr);
         return get(x, y, dx, dy) += dv;
     }
 
     T& get(int x, int y, int dx, int dy) {
         assert(v.get() != nullptr);
-        size_t i = std::ranges::find(deltas, std::make_pair(dx, dy)) - deltas.begin();
-        assert(i < deltas.size());
-        return (*v)[x][y][i];
+        return (*v)[x][y][delta_index(dx, dy)];
+    }
+};
+
+/// VectorField, that is cleared in O(1) instead of O(n * m): each cell is
+/// tagged with the epoch of its last write, cells of older epochs read as
+/// zero and are zeroed on the first write, see advance_epoch.
+template<typename T, typename Tag>
+struct LazyVectorField {
+    VectorField<T> values;
+    std::unique_ptr<AbstractMatrix<Tag>> tags = nullptr;
+    /// Tags start zeroed along with the values, so the cells are current
+    Tag epoch = 0;
+
+    LazyVectorField() = default;
+
+    LazyVectorField(size_t n, size_t m, const MatrixOptions& options = {})
+      : values(n, m, options),
+        tags(create_matrix<Tag>{}(n, m, options))
+    {}
+
+    /// Takes ownership of the matrices
+    LazyVectorField(AbstractMatrix<std::array<T, deltas.size()>>* values, AbstractMatrix<Tag>* tags)
+      : values(values),
+        tags(tags)
+    {}
+
+    /// Makes all cells zero. Returns true, if the epoch has restarted and
+    /// clear_tags must be called before the next access.
+    [[nodiscard]] bool reset() {
+        return advance_epoch(epoch);
+    }
+
+    /// Clears the tags for real, O(n * m)
+    void clear_tags() {
+        tags->reset();
+    }
+
+    T get(int x, int y, int dx, int dy) const {
+        if ((*tags)[x][y] != epoch) {
+            return T{};
+        }
+        return (*values.v)[x][y][delta_index(dx, dy)];
+    }
+
+    std::array<T, deltas.size()> get_cell(size_t x, size_t y) const {
+        if ((*tags)[x][y] != epoch) {
+            return {};
+        }
+        return (*values.v)[x][y];
+    }
+
+    template<typename U>
+    T& add(int x, int y, int dx, int dy, U dv) {
+        auto& tag = (*tags)[x][y];
+        if (tag != epoch) {
+            (*values.v)[x][y] = {};
+            tag = epoch;
+        }
+        return (*values.v)[x][y][delta_index(dx, dy)] += dv;
     }
 };
@@ -0,0 +1,112 @@
+#include "Protocol.hpp"
+#include "Scaling.hpp"
+#include "argv_parse.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+/// Submits a single job to fluid --server and prints what comes back:
+///     fluid-client --socket=<path> --p-type=... --v-type=... --v-flow-type=...
+///         [--ticks=N] [--seed=S] [--progress-every=N] [--frame-every=N]
+///         [--send-path=true] <scenario>
+/// With --send-path=true the server reads the scenario itself, otherwise the
+/// file is sent inline.
+
+int connect_to(const std::string& socket_path) {
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    if (socket_path.size() >= sizeof(addr.sun_path)) {
+        throw std::runtime_error("socket path is too long");
+    }
+    std::strcpy(addr.sun_path, socket_path.c_str());
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        throw std::runtime_error("failed to create socket");
+    }
+    if (connect(fd, (const sockaddr*) &addr, sizeof(addr)) != 0) {
+        close(fd);
+        throw std::runtime_error(std::string("failed to connect: ") + std::strerror(errno));
+    }
+    return fd;
+}
+
+int main(int argc, char** argv) {
+    auto opts = argv_parse(argv);
+
+    if (opts.positional.size() != 1) {
+        throw std::runtime_error("exactly one positional argument expected");
+    }
+
+    JobRequest request{
+        .types = {
+            .p_type = opts.get("p-type"),
+            .v_type = opts.get("v-type"),
+            .v_flow_type = opts.get("v-flow-type"),
+        },
+        .ticks = 1'000'000,
+    };
+
+    auto* send_path = opts.get_if("send-path");
+    if (send_path != nullptr && *send_path == "true") {
+        request.scenario = opts.positional.front();
+        request.scenario_is_path = true;
+    } else {
+        request.scenario = read_scenario(opts.positional.front());
+    }
+
+    if (auto* ticks = opts.get_if("ticks")) {
+        request.ticks = std::stoull(*ticks);
+    }
+    if (auto* seed = opts.get_if("seed")) {
+        request.seed = std::stoul(*seed);
+    }
+    if (auto* progress_every = opts.get_if("progress-every")) {
+        request.progress_every = std::stoull(*progress_every);
+    }
+    if (auto* frame_every = opts.get_if("frame-every")) {
+        request.frame_every = std::stoull(*frame_every);
+    }
+
+    int fd = connect_to(opts.get("socket"));
+    send_message(fd, encode(request));
+
+    while (auto message = receive_message(fd)) {
+        switch (message->type) {
+            case MessageType::PROGRESS: {
+                auto progress = decode_progress(*message);
+                std::cout << "Tick " << progress.tick << (progress.moved ? "" : " (nothing moved)") << std::endl;
+                break;
+            }
+            case MessageType::FRAME: {
+                auto frame = decode_frame(*message);
+                std::cout << "Tick " << frame.tick << ":\n";
+                for (size_t x = 0; x < frame.n; ++x) {
+                    std::cout.write(frame.field.data() + x * frame.m, frame.m) << "\n";
+                }
+                std::cout << std::endl;
+                break;
+            }
+            case MessageType::RESULT: {
+                auto result = decode_result(*message);
+                std::cout
+                    << "Done " << result.ticks_done << " ticks in "
+                    << result.seconds << "s" << std::endl;
+                close(fd);
+                return 0;
+            }
+            default:
+                // ERROR or garbage, decode throws with the message
+                decode_result(*message);
+        }
+    }
+    close(fd);
+    throw std::runtime_error("connection closed before the result");
+}
@@ -1,5 +1,22 @@
 #pragma once
 
+#include <algorithm>
 #include <array>
+#include <cstddef>
 
 constexpr std::array<std::pair<int, int>, 4> deltas{{{-1, 0}, {1, 0}, {0, -1}, {0, 1}}};
+
+/// Index of (dx, dy) in deltas. Is on the hot path of every phase, so it is
+/// computed from the order of deltas instead of searching them.
+constexpr size_t delta_index(int dx, int dy) {
+    return dx != 0 ? (dx + 1) / 2 : 2 + (dy + 1) / 2;
+}
+
+static_assert([] {
+    for (size_t i = 0; i < deltas.size(); ++i) {
+        if (delta_index(deltas[i].first, deltas[i].second) != i) {
+            return false;
+        }
+    }
+    return true;
+}(), "delta_index does not match deltas");
@@ -1,130 +1,557 @@
-#include "Fluid.hpp"
-#include "Fixed.hpp"
-#include "FastFixed.hpp"
+#include "Autotune.hpp"
+#include "Commands.hpp"
+#include "Metrics.hpp"
+#include "PerfCounters.hpp"
+#include "Realtime.hpp"
+#include "Scaling.hpp"
+#include "Server.hpp"
+#include "Simulation.hpp"
+#include "Slabs.hpp"
+#include "StateHash.hpp"
 #include "argv_parse.hpp"
-#include "type_list.hpp"
-#include "type_marker.hpp"
-#include "type_utils.hpp"
 
-#include <cctype>
 #include <chrono>
-#include <sstream>
+#include <csignal>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <optional>
 #include <stdexcept>
 #include <string>
 #include <string_view>
 
+#include <unistd.h>
+
 struct real_main {
     std::string filename;
+    /// Continue the simulation from options.storage_file instead of filename
+    bool resume = false;
     size_t ticks_count = 1'000'000;
     bool quiet = false;
+    SteadyCriteria steady;
+    FluidOptions options;
+    size_t scaling_threads = 0;
+    bool weak_scaling = false;
+
+    /// State is hashed every hash_every ticks, see StateHash
+    size_t hash_every = 0;
+    std::string hash_log;
+    std::string hash_check;
+    /// Set, if hashes differ from hash_check
+    std::optional<std::string> divergence;
+
+    /// The storage file is made a checkpoint every checkpoint_every ticks
+    size_t checkpoint_every = 0;
+
+    /// Hardware counters of phases are written there as JSON, see
+    /// write_counters_json
+    std::string perf_json;
+
+    /// Frames per second of run_realtime, 0 to run as fast as possible
+    double realtime_fps = 0;
+
+    /// Edits are read from there between ticks, see apply_command
+    std::string commands;
+
+    /// Metrics are exported there every metrics_interval, see
+    /// MetricsExporter
+    std::string metrics_file;
+    std::chrono::duration<double> metrics_interval{1.0};
+
+    /// Number of processes, that share the grid by slabs, see SlabGroup
+    size_t processes = 1;
+
+    /// Body of a follower process of slabs. Followers are silent, only the
+    /// leader prints.
+    [[noreturn]] void follow(const SimulationTypes& types) {
+        int status = 0;
+        std::cout.setstate(std::ios::failbit);
+        try {
+            auto simulation = Simulation::create(read_scenario(filename), types, options);
+            simulation->follow();
+        } catch (const std::exception& e) {
+            std::cerr << "Slab process " << options.slabs->get_rank() << " failed: " << e.what() << std::endl;
+            options.slabs->fail();
+            status = 1;
+        }
+        // State of the leader, that was copied by fork, is not destroyed
+        _exit(status);
+    }
+
+    void run(const SimulationTypes& types) {
+        // Followers are forked before any thread is started
+        std::optional<SlabGroup> slabs;
+        if (processes > 1) {
+            slabs.emplace(processes);
+            options.slabs = &*slabs;
+            std::cout.flush();
+            if (slabs->launch() != 0) {
+                follow(types);
+            }
+        }
+
+        // The exporter watches the pool, so the pool is not owned by the
+        // simulation and outlives the exporter
+        std::optional<ThreadPool> pool;
+        SimulationMetrics metrics;
+        if (!metrics_file.empty()) {
+            pool.emplace(options.threads, options.pinning);
+            options.pool = &*pool;
+            options.metrics = &metrics;
+        }
 
-    template<typename P_TYPE, typename V_TYPE, typename V_FLOW_TYPE>
-    void run() {
+        std::string scenario;
+        std::unique_ptr<Simulation> simulation;
+        if (resume) {
+            simulation = Simulation::resume(types, options);
+            std::cout << "Resumed at tick " << simulation->get_tick() << "\n" << std::endl;
+        } else {
+            scenario = read_scenario(filename);
+            simulation = Simulation::create(scenario, types, options);
+        }
+
+        auto names = simulation->type_names();
         std::cout << "Using following types:\n"
-            << "p-type:      " << get_type_name<P_TYPE>() << "\n"
-            << "v-type:      " << get_type_name<V_TYPE>() << "\n"
-            << "v-flow-type: " << get_type_name<V_FLOW_TYPE>() << "\n"
+            << "p-type:      " << names[0] << "\n"
+            << "v-type:      " << names[1] << "\n"
+            << "v-flow-type: " << names[2] << "\n"
             << std::endl;
 
-        Fluid<P_TYPE, V_TYPE, V_FLOW_TYPE> fluid(filename);
+        if (scaling_threads > 0) {
+            simulation.reset();
+            run_scaling(scenario, types, options, ticks_count, scaling_threads, weak_scaling);
+            return;
+        }
+
+        simulation->set_steady_criteria(steady);
 
+        std::ofstream hash_log_file;
+        std::optional<HashChecker> hash_checker;
+        if (hash_every > 0) {
+            if (!hash_log.empty()) {
+                hash_log_file.open(hash_log);
+                if (!hash_log_file) {
+                    throw std::runtime_error("failed to open hash log");
+                }
+            }
+            if (!hash_check.empty()) {
+                hash_checker.emplace(hash_check);
+            }
+            // Printed, unless hashes are only checked
+            std::ostream* hash_out = nullptr;
+            if (hash_log_file.is_open()) {
+                hash_out = &hash_log_file;
+            } else if (!hash_checker) {
+                hash_out = &std::cout;
+            }
+
+            // A resumed run does not start at tick 0
+            bool header_written = false;
+            simulation->on_tick([&, hash_out, header_written, sim = simulation.get()](const Simulation&, const TickInfo& info) mutable {
+                if (info.tick % hash_every != 0) {
+                    return;
+                }
+                auto hash = sim->state_hash();
+                if (hash_out != nullptr) {
+                    if (!header_written) {
+                        write_hash_header(*hash_out, hash);
+                        header_written = true;
+                    }
+                    write_hash(*hash_out, info.tick, hash);
+                }
+                if (hash_checker) {
+                    divergence = hash_checker->check(info.tick, hash);
+                    if (divergence) {
+                        sim->request_stop();
+                    }
+                }
+            });
+        }
+
+        if (checkpoint_every > 0) {
+            simulation->on_tick([this, sim = simulation.get()](const Simulation&, const TickInfo& info) {
+                if ((info.tick + 1) % checkpoint_every == 0) {
+                    sim->checkpoint();
+                }
+            });
+        }
+
+        std::optional<MetricsExporter> exporter;
+        if (!metrics_file.empty()) {
+            exporter.emplace(metrics_file, metrics_interval, metrics, &*pool);
+        }
+
+        std::optional<CommandChannel> channel;
+        if (!commands.empty()) {
+            channel.emplace(commands);
+            simulation->on_tick([&channel, sim = simulation.get()](const Simulation&, const TickInfo& info) {
+                for (const auto& command : channel->poll()) {
+                    auto start = std::chrono::steady_clock::now();
+                    try {
+                        apply_command(*sim, command);
+                    } catch (const std::exception& e) {
+                        std::cerr << "Command '" << command << "' failed: " << e.what() << std::endl;
+                        continue;
+                    }
+                    std::chrono::duration<double, std::milli> duration = std::chrono::steady_clock::now() - start;
+                    std::cout << "Tick " << info.tick << ": applied '" << command << "' in " << duration << std::endl;
+                }
+            });
+        }
+
+        std::optional<RealtimeStats> realtime;
         auto start_time = std::chrono::system_clock::now();
-        fluid.run(ticks_count, quiet);
+        if (realtime_fps > 0) {
+            realtime = run_realtime(*simulation, realtime_fps, ticks_count, std::cout, isatty(STDOUT_FILENO));
+        } else {
+            simulation->step(ticks_count, quiet);
+        }
         auto end_time = std::chrono::system_clock::now();
         auto duration = std::chrono::duration_cast<std::chrono::duration<double>>(end_time - start_time);
 
-        std::cout << "\nExcuted in " << duration << std::endl;
-    }
-};
+        if (divergence) {
+            std::cout << "\nDeterminism check failed: " << *divergence << std::endl;
+        } else if (hash_checker) {
+            std::cout << "\nHashes match " << hash_check << std::endl;
+        }
 
-std::string to_lower_rm_space(std::string_view s) {
-    std::string ans;
-    ans.reserve(s.size());
-    for (char c : s) {
-        if (isspace(c)) {
-            continue;;
+        if (simulation->is_steady()) {
+            std::cout << "\nConverged at tick " << simulation->get_tick() - 1 << std::endl;
+        } else if (steady.enabled() && !divergence) {
+            std::cout << "\nNot converged in " << ticks_count << " ticks" << std::endl;
         }
-        ans.push_back(tolower(c));
-    }
-    return ans;
-}
 
-struct double_type_marker {
-    using type = double;
+        std::cout << "\nExcuted in " << duration << std::endl;
 
-    bool matches(std::string_view s) const {
-        return to_lower_rm_space(s) == "double";
-    }
-};
+        const auto& stats = simulation->get_phase_stats();
+        for (size_t phase = 0; phase < PHASES_COUNT; ++phase) {
+            std::cout << "    " << phase_names[phase] << ": " << stats.time[phase] << "\n";
+        }
+        std::cout << std::flush;
 
-struct float_type_marker {
-    using type = float;
+        if (realtime) {
+            print_realtime_stats(std::cout, *realtime);
+        }
 
-    bool matches(std::string_view s) const {
-        return to_lower_rm_space(s) == "float";
-    }
-};
+        if (options.perf_counters) {
+            print_counters(std::cout, stats);
+        }
+        if (!perf_json.empty()) {
+            std::ofstream fout(perf_json);
+            if (!fout) {
+                throw std::runtime_error("failed to open perf-json file");
+            }
+            write_counters_json(fout, stats);
+        }
 
-template<size_t N, size_t K>
-struct fixed_type_marker {
-    using type = Fixed<N, K>;
+        // Writes the final sample
+        exporter.reset();
 
-    bool matches(std::string_view s) const {
-        std::stringstream ss;
-        ss << "fixed(" << N << "," << K << ")";
-        return to_lower_rm_space(s) == ss.str();
-    }  
+        // Lets the followers finish
+        simulation.reset();
+        if (slabs && !slabs->join()) {
+            throw std::runtime_error("a slab process has failed");
+        }
+    }
 };
 
-template<size_t N, size_t K>
-struct fast_fixed_type_marker {
-    using type = FastFixed<N, K>;
+Server* running_server = nullptr;
 
-    bool matches(std::string_view s) const {
-        std::stringstream ss;
-        ss << "fast_fixed(" << N << "," << K << ")";
-        return to_lower_rm_space(s) == ss.str();
-    }  
-};
+void stop_server(int) {
+    if (running_server != nullptr) {
+        running_server->stop();
+    }
+}
 
-#define FLOAT float_type_marker
-#define DOUBLE double_type_marker
-#define FIXED(N, K) fixed_type_marker<N, K>
-#define FAST_FIXED(N, K) fast_fixed_type_marker<N, K>
+bool parse_bool(const std::string& s) {
+    if (s == "true") {
+        return true;
+    } else if (s == "false") {
+        return false;
+    } else {
+        throw std::runtime_error("either 'true' or 'false' expected");
+    }
+}
 
 int main(int argc, char** argv) {
     real_main r_main;
 
     auto opts = argv_parse(argv);
 
-    auto p_type_str = opts.get("p-type");
-    auto v_type_str = opts.get("v-type");
-    auto v_flow_type_str = opts.get("v-flow-type");
-
-    if (opts.positional.size() != 1) {
-        throw std::runtime_error("exactly one positional argument expected");
+    // Scenarios of the server come from its clients
+    auto* server_socket = opts.get_if("server");
+    if (server_socket != nullptr) {
+        if (!opts.positional.empty()) {
+            throw std::runtime_error("no positional arguments expected in server mode");
+        }
+    } else if (auto* resume = opts.get_if("resume")) {
+        // The checkpoint replaces the scenario
+        if (!opts.positional.empty()) {
+            throw std::runtime_error("no positional arguments expected with resume");
+        }
+        r_main.resume = true;
+        r_main.options.storage = Storage::FILE;
+        r_main.options.storage_file = *resume;
+    } else {
+        if (opts.positional.size() != 1) {
+            throw std::runtime_error("exactly one positional argument expected");
+        }
+        r_main.filename = opts.positional.front();
     }
-    r_main.filename = opts.positional.front();
 
     if (auto* ticks_count = opts.get_if("ticks")) {
         r_main.ticks_count = std::stoi(*ticks_count);
     }
 
     if (auto* quiet = opts.get_if("quiet")) {
-        if (*quiet == "true") {
-            r_main.quiet = true;
-        } else if (*quiet == "false") {
-            r_main.quiet = true;
+        r_main.quiet = parse_bool(*quiet);
+    }
+
+    if (auto* fuse_phases = opts.get_if("fuse-phases")) {
+        r_main.options.fuse_phases = parse_bool(*fuse_phases);
+    }
+
+    if (auto* tile_n = opts.get_if("tile-rows")) {
+        r_main.options.tile_n = std::stoul(*tile_n);
+    }
+
+    if (auto* tile_m = opts.get_if("tile-cols")) {
+        r_main.options.tile_m = std::stoul(*tile_m);
+    }
+
+    if (auto* threads = opts.get_if("threads")) {
+        r_main.options.threads = std::stoul(*threads);
+    }
+
+    if (auto* seed = opts.get_if("seed")) {
+        r_main.options.seed = std::stoul(*seed);
+    }
+
+    if (auto* pin = opts.get_if("pin")) {
+        r_main.options.pinning = ThreadPinning::parse(*pin);
+    }
+
+    if (auto* numa = opts.get_if("numa")) {
+        if (*numa == "none") {
+            r_main.options.numa = NumaPolicy::NONE;
+        } else if (*numa == "first-touch") {
+            r_main.options.numa = NumaPolicy::FIRST_TOUCH;
+        } else if (*numa == "interleave") {
+            r_main.options.numa = NumaPolicy::INTERLEAVE;
+        } else {
+            throw std::runtime_error("one of 'none', 'first-touch' or 'interleave' expected");
+        }
+    }
+
+    if (auto* storage = opts.get_if("storage")) {
+        if (r_main.resume) {
+            throw std::runtime_error("storage of a resumed simulation is its checkpoint");
+        }
+        if (*storage == "dense") {
+            r_main.options.storage = Storage::DENSE;
+        } else if (*storage == "chunked") {
+            r_main.options.storage = Storage::CHUNKED;
+        } else if (*storage == "file") {
+            r_main.options.storage = Storage::FILE;
+        } else {
+            throw std::runtime_error("one of 'dense', 'chunked' or 'file' expected");
+        }
+    }
+
+    if (auto* storage_file = opts.get_if("storage-file")) {
+        if (r_main.options.storage != Storage::FILE || r_main.resume) {
+            throw std::runtime_error("storage-file requires storage=file");
+        }
+        r_main.options.storage_file = *storage_file;
+    }
+
+    if (r_main.options.storage == Storage::FILE && r_main.options.storage_file.empty()) {
+        throw std::runtime_error("storage=file requires storage-file");
+    }
+
+    if (auto* propagate = opts.get_if("propagate")) {
+        if (*propagate == "exact") {
+            r_main.options.propagate = Propagate::EXACT;
+        } else if (*propagate == "fast") {
+            r_main.options.propagate = Propagate::FAST;
+        } else {
+            throw std::runtime_error("either 'exact' or 'fast' expected");
+        }
+    }
+
+    if (auto* perf_counters = opts.get_if("perf-counters")) {
+        r_main.options.perf_counters = parse_bool(*perf_counters);
+    }
+
+    if (auto* perf_json = opts.get_if("perf-json")) {
+        r_main.perf_json = *perf_json;
+        r_main.options.perf_counters = true;
+    }
+
+    if (auto* realtime = opts.get_if("realtime")) {
+        r_main.realtime_fps = std::stod(*realtime);
+        if (!(r_main.realtime_fps > 0)) {
+            throw std::runtime_error("realtime should be a positive frame rate");
+        }
+    }
+
+    if (auto* commands = opts.get_if("commands")) {
+        r_main.commands = *commands;
+    }
+
+    if (auto* metrics_file = opts.get_if("metrics-file")) {
+        r_main.metrics_file = *metrics_file;
+    }
+
+    if (auto* metrics_interval = opts.get_if("metrics-interval")) {
+        if (r_main.metrics_file.empty()) {
+            throw std::runtime_error("metrics-interval requires metrics-file");
+        }
+        r_main.metrics_interval = std::chrono::duration<double>(std::stod(*metrics_interval));
+    }
+
+    if (auto* processes = opts.get_if("processes")) {
+        r_main.processes = std::stoul(*processes);
+        if (r_main.processes == 0) {
+            throw std::runtime_error("processes should be positive");
+        }
+    }
+
+    if (auto* checkpoint_every = opts.get_if("checkpoint-every")) {
+        r_main.checkpoint_every = std::stoul(*checkpoint_every);
+        if (r_main.options.storage != Storage::FILE) {
+            throw std::runtime_error("checkpoint-every requires storage=file or resume");
+        }
+    }
+
+    if (auto* arena = opts.get_if("arena")) {
+        r_main.options.arena = parse_bool(*arena);
+    }
+
+    if (auto* huge_pages = opts.get_if("huge-pages")) {
+        if (*huge_pages == "none") {
+            r_main.options.huge_pages = HugePages::NONE;
+        } else if (*huge_pages == "madvise") {
+            r_main.options.huge_pages = HugePages::MADVISE;
+        } else if (*huge_pages == "hugetlb") {
+            r_main.options.huge_pages = HugePages::HUGETLB;
+        } else {
+            throw std::runtime_error("one of 'none', 'madvise' or 'hugetlb' expected");
+        }
+    }
+
+    if (auto* scaling = opts.get_if("scaling")) {
+        r_main.scaling_threads = std::stoul(*scaling);
+    }
+
+    if (auto* scaling_mode = opts.get_if("scaling-mode")) {
+        if (*scaling_mode == "strong") {
+            r_main.weak_scaling = false;
+        } else if (*scaling_mode == "weak") {
+            r_main.weak_scaling = true;
         } else {
-            throw std::runtime_error("either 'true' or 'false' expected");
+            throw std::runtime_error("either 'strong' or 'weak' expected");
         }
     }
 
-    using types = type_list<TYPES>;
-    using types_product = product<types, types, types>::type;
+    if (auto* still_ticks = opts.get_if("until-steady")) {
+        r_main.steady.still_ticks = std::stoul(*still_ticks);
+        if (r_main.steady.still_ticks == 0) {
+            throw std::runtime_error("until-steady should be positive");
+        }
+    }
+
+    if (auto* max_dp = opts.get_if("steady-max-dp")) {
+        r_main.steady.max_dp = std::stod(*max_dp);
+    }
+
+    if (auto* max_energy = opts.get_if("steady-max-energy")) {
+        r_main.steady.max_energy = std::stod(*max_energy);
+    }
+
+    if (!r_main.steady.enabled() && (opts.get_if("steady-max-dp") || opts.get_if("steady-max-energy"))) {
+        throw std::runtime_error("steady-max-* options require until-steady");
+    }
+
+    if (auto* hash_every = opts.get_if("hash-every")) {
+        r_main.hash_every = std::stoul(*hash_every);
+    }
+
+    if (auto* hash_log = opts.get_if("hash-log")) {
+        r_main.hash_log = *hash_log;
+    }
+
+    if (auto* hash_check = opts.get_if("hash-check")) {
+        r_main.hash_check = *hash_check;
+    }
+
+    if (r_main.hash_every == 0 && (!r_main.hash_log.empty() || !r_main.hash_check.empty())) {
+        throw std::runtime_error("hash-log and hash-check require hash-every");
+    }
+
+    std::optional<double> autotune_bound;
+    if (auto* autotune = opts.get_if("autotune")) {
+        autotune_bound = std::stod(*autotune);
+    }
+
+    size_t autotune_ticks = 100;
+    if (auto* ticks = opts.get_if("autotune-ticks")) {
+        autotune_ticks = std::stoul(*ticks);
+    }
+
+    if (r_main.resume && (r_main.scaling_threads > 0 || autotune_bound)) {
+        throw std::runtime_error("resume can not be combined with scaling or autotune");
+    }
+
+    if (r_main.processes > 1 && (r_main.options.storage != Storage::DENSE || r_main.steady.enabled())) {
+        throw std::runtime_error("processes require dense storage and no until-steady");
+    }
+
+    if (r_main.processes > 1 && r_main.options.propagate == Propagate::FAST) {
+        throw std::runtime_error("processes require propagate=exact");
+    }
+
+    if (r_main.processes > 1 && (r_main.scaling_threads > 0 || autotune_bound || server_socket != nullptr)) {
+        throw std::runtime_error("processes can not be combined with scaling, autotune or server");
+    }
+
+    if (r_main.realtime_fps > 0 && (r_main.scaling_threads > 0 || autotune_bound || server_socket != nullptr)) {
+        throw std::runtime_error("realtime can not be combined with scaling, autotune or server");
+    }
+
+    if (!r_main.metrics_file.empty() && (r_main.scaling_threads > 0 || autotune_bound || server_socket != nullptr)) {
+        throw std::runtime_error("metrics-file can not be combined with scaling, autotune or server");
+    }
+
+    if (!r_main.commands.empty() && (r_main.processes > 1 || r_main.scaling_threads > 0 || autotune_bound || server_socket != nullptr)) {
+        throw std::runtime_error("commands can not be combined with processes, scaling, autotune or server");
+    }
+
+    if (server_socket != nullptr) {
+        if (r_main.options.storage == Storage::FILE) {
+            throw std::runtime_error("jobs of the server can not share a storage file");
+        }
+        Server server(*server_socket, r_main.options);
+        running_server = &server;
+        std::signal(SIGINT, stop_server);
+        std::signal(SIGTERM, stop_server);
+        std::cout << "Listening on " << *server_socket << std::endl;
+        server.run();
+        running_server = nullptr;
+        return 0;
+    }
+
+    if (autotune_bound) {
+        Autotuner autotuner(read_scenario(r_main.filename), r_main.options, autotune_ticks);
+        autotuner.run_all();
+        print_autotune(autotuner.results, autotune_ticks, *autotune_bound);
+        return 0;
+    }
 
-    run_for_matching<real_main, types_product>{}(
-        r_main,
-        {p_type_str, v_type_str, v_flow_type_str}
-    );
+    r_main.run({
+        .p_type = opts.get("p-type"),
+        .v_type = opts.get("v-type"),
+        .v_flow_type = opts.get("v-flow-type"),
+    });
+    return r_main.divergence ? 1 : 0;
 }
@@ -0,0 +1,263 @@
+#include "Matrix.hpp"
+#include "Rnd.hpp"
+#include "ThreadPool.hpp"
+#include "VectorField.hpp"
+#include "argv_parse.hpp"
+#include "type_markers.hpp"
+
+#include <chrono>
+#include <cstddef>
+#include <iostream>
+#include <random>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/// Microbenchmarks of the building blocks of the simulation:
+///     fluid-microbench [--filter=<substring>] [--min-time=<seconds>]
+///         [--max-threads=N]
+/// Each result is printed as a JSON object on its own line:
+///     {"bench": "mul", "variant": "fixed(32,16)", "ns_per_op": 0.71, "ops": 67108864}
+/// Only benchmarks, whose "bench/variant" contains the filter, are run.
+
+/// Keeps the value alive without letting the compiler see its use
+template<typename T>
+void do_not_optimize(const T& value) {
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+struct Runner {
+    std::string filter;
+    double min_time = 0.2;
+
+    /// f does ops_per_call operations. Calls are doubled until they take
+    /// min_time.
+    template<typename F>
+    void run(std::string_view bench, std::string_view variant, size_t ops_per_call, const F& f) {
+        std::string name = std::string(bench) + "/" + std::string(variant);
+        if (name.find(filter) == std::string::npos) {
+            return;
+        }
+
+        using clock = std::chrono::steady_clock;
+        // Warm up caches and the branch predictor
+        f();
+        for (size_t calls = 1; ; calls *= 2) {
+            auto start = clock::now();
+            for (size_t i = 0; i < calls; ++i) {
+                f();
+            }
+            double seconds = std::chrono::duration<double>(clock::now() - start).count();
+            if (seconds >= min_time || calls >= (size_t(1) << 40)) {
+                size_t ops = calls * ops_per_call;
+                std::cout
+                    << "{\"bench\": \"" << bench << "\", \"variant\": \"" << variant
+                    << "\", \"ns_per_op\": " << seconds * 1e9 / ops
+                    << ", \"ops\": " << ops << "}" << std::endl;
+                return;
+            }
+        }
+    }
+};
+
+/// Operands are in [0.25, 0.5), so that products and quotients fit every
+/// width of the fixed point types
+constexpr size_t OPERANDS = 1024;
+
+template<typename Marker>
+void bench_arithmetic(Runner& runner) {
+    using T = typename Marker::type;
+    std::string name = Marker{}.name();
+
+    std::mt19937 gen(1);
+    std::uniform_real_distribution<> dist(0.25, 0.5);
+    std::vector<T> a(OPERANDS), b(OPERANDS), c(OPERANDS);
+    for (size_t i = 0; i < OPERANDS; ++i) {
+        a[i] = T(dist(gen));
+        b[i] = T(dist(gen));
+    }
+
+    auto bench = [&](std::string_view op, const auto& apply) {
+        runner.run(op, name, OPERANDS, [&] {
+            for (size_t i = 0; i < OPERANDS; ++i) {
+                c[i] = apply(a[i], b[i]);
+            }
+            do_not_optimize(c);
+        });
+    };
+    bench("add", [](T x, T y) { return T(x + y); });
+    bench("sub", [](T x, T y) { return T(x - y); });
+    bench("mul", [](T x, T y) { return T(x * y); });
+    bench("div", [](T x, T y) { return T(x / y); });
+}
+
+template<typename... Markers>
+void bench_all_arithmetic(Runner& runner) {
+    (bench_arithmetic<Markers>(runner), ...);
+}
+
+template<typename Marker>
+void bench_random(Runner& runner) {
+    using T = typename Marker::type;
+    constexpr size_t DRAWS = 1024;
+    Rnd rnd;
+    runner.run("random01", Marker{}.name(), DRAWS, [&] {
+        for (size_t i = 0; i < DRAWS; ++i) {
+            do_not_optimize(rnd.random01<T>());
+        }
+    });
+}
+
+/// Matrices report their kind on construction, which would break the
+/// output format
+template<typename F>
+auto silently(const F& f) {
+    std::cout.setstate(std::ios::failbit);
+    auto ans = f();
+    std::cout.clear();
+    return ans;
+}
+
+/// Side of the matrices of access benchmarks, fits L2
+constexpr size_t GRID = 64;
+
+void bench_vector_field(Runner& runner) {
+    auto field = silently([] { return VectorField<double>(GRID, GRID); });
+    constexpr size_t OPS = GRID * GRID * deltas.size();
+
+    runner.run("vector_field", "get", OPS, [&] {
+        double sum = 0;
+        for (size_t x = 0; x < GRID; ++x) {
+            for (size_t y = 0; y < GRID; ++y) {
+                for (auto [dx, dy] : deltas) {
+                    sum += field.get(x, y, dx, dy);
+                }
+            }
+        }
+        do_not_optimize(sum);
+    });
+
+    runner.run("vector_field", "index", OPS, [&] {
+        double sum = 0;
+        for (size_t x = 0; x < GRID; ++x) {
+            for (size_t y = 0; y < GRID; ++y) {
+                const auto& v = (*field.v)[x][y];
+                for (size_t i = 0; i < deltas.size(); ++i) {
+                    sum += v[i];
+                }
+            }
+        }
+        do_not_optimize(sum);
+    });
+}
+
+/// Hides the value from the optimizer, e.g. the dynamic type of an object
+/// behind a pointer
+template<typename T>
+T* launder(T* ptr) {
+    asm volatile("" : "+r"(ptr));
+    return ptr;
+}
+
+/// Sums matrix(x, y) over the grid. Several independent accumulators keep
+/// the latency of additions out of the cost of access.
+template<typename F>
+double sum_grid(const F& matrix) {
+    double sums[4]{};
+    for (size_t x = 0; x < GRID; ++x) {
+        for (size_t y = 0; y < GRID; y += 4) {
+            sums[0] += matrix(x, y);
+            sums[1] += matrix(x, y + 1);
+            sums[2] += matrix(x, y + 2);
+            sums[3] += matrix(x, y + 3);
+        }
+    }
+    return sums[0] + sums[1] + sums[2] + sums[3];
+}
+
+void bench_matrix(Runner& runner) {
+    auto matrix = silently([] { return DynamicMatrix<double>(GRID, GRID); });
+    constexpr size_t OPS = GRID * GRID;
+
+    runner.run("matrix", "virtual", OPS, [&] {
+        // Calls are not devirtualized
+        AbstractMatrix<double>* abstract = launder<AbstractMatrix<double>>(&matrix);
+        do_not_optimize(sum_grid([abstract](size_t x, size_t y) {
+            return abstract->at(x, y);
+        }));
+    });
+
+    runner.run("matrix", "direct", OPS, [&] {
+        do_not_optimize(sum_grid([&matrix](size_t x, size_t y) {
+            return matrix.DynamicMatrix<double>::at(x, y);
+        }));
+    });
+
+    std::vector<double> plain(GRID * GRID);
+    runner.run("matrix", "plain", OPS, [&] {
+        do_not_optimize(sum_grid([&plain](size_t x, size_t y) {
+            return plain[x * GRID + y];
+        }));
+    });
+}
+
+/// Latency of a batch of empty tasks, one per thread
+void bench_thread_pool(Runner& runner, size_t max_threads) {
+    for (size_t threads = 1; threads <= max_threads; ++threads) {
+        ThreadPool pool(threads);
+        std::string variant = "threads=" + std::to_string(threads);
+
+        runner.run("pool_add_wait_all", variant, 1, [&] {
+            for (size_t i = 0; i < threads; ++i) {
+                pool.add_task([] {});
+            }
+            pool.wait_all();
+        });
+
+        TaskGroup group(pool);
+        runner.run("group_add_wait", variant, 1, [&] {
+            for (size_t i = 0; i < threads; ++i) {
+                group.add_task_for(i, [] {});
+            }
+            group.wait();
+        });
+    }
+}
+
+int main(int argc, char** argv) {
+    auto opts = argv_parse(argv);
+
+    Runner runner;
+    if (auto* filter = opts.get_if("filter")) {
+        runner.filter = *filter;
+    }
+    if (auto* min_time = opts.get_if("min-time")) {
+        runner.min_time = std::stod(*min_time);
+    }
+    size_t max_threads = default_threads_count();
+    if (auto* threads = opts.get_if("max-threads")) {
+        max_threads = std::stoul(*threads);
+    }
+
+    bench_all_arithmetic<
+        float_type_marker,
+        double_type_marker,
+        fixed_type_marker<8, 4>,
+        fixed_type_marker<16, 8>,
+        fixed_type_marker<32, 16>,
+        fixed_type_marker<64, 32>,
+        fast_fixed_type_marker<8, 4>,
+        fast_fixed_type_marker<16, 8>,
+        fast_fixed_type_marker<32, 16>,
+        fast_fixed_type_marker<64, 32>
+    >(runner);
+
+    bench_random<float_type_marker>(runner);
+    bench_random<double_type_marker>(runner);
+    bench_random<fixed_type_marker<32, 16>>(runner);
+    bench_random<fixed_type_marker<64, 32>>(runner);
+
+    bench_vector_field(runner);
+    bench_matrix(runner);
+    bench_thread_pool(runner, max_threads);
+}
@@ -3,6 +3,7 @@
 #include "type_list.hpp"
 
 #include <stdexcept>
+#include <string>
 #include <string_view>
 #include <tuple>
 
@@ -11,6 +12,8 @@ concept is_type_marker = requires(const T& t, std::string_view s) {
     typename T::type;
 
     { t.matches(s) } -> std::same_as<bool>;
+    /// Spelling of the type in options, that matches
+    { t.name() } -> std::convertible_to<std::string>;
 } && std::is_default_constructible<T>::value;
 
 template<typename T>
@@ -67,3 +70,21 @@ struct run_for_matching<F, type_list<>> {
         throw std::runtime_error("suitable implementation was not found");
     }
 };
+
+/// Calls func.template run<Ms...>() with markers (not types) for each list of
+/// markers, e.g. to try every compiled combination of types
+template<typename... Ts>
+struct run_for_all;
+
+template<typename F, is_type_marker_list... Ls>
+struct run_for_all<F, type_list<Ls...>> {
+    void operator()(F& func) {
+        (run_list(func, Ls{}), ...);
+    }
+
+    private:
+        template<is_type_marker... Ms>
+        static void run_list(F& func, type_list<Ms...>) {
+            func.template run<Ms...>();
+        }
+};
@@ -0,0 +1,100 @@
+#pragma once
+
+#include "FastFixed.hpp"
+#include "Fixed.hpp"
+#include "PackedFixed.hpp"
+#include "type_marker.hpp"
+
+#include <cctype>
+#include <sstream>
+#include <string>
+#include <string_view>
+
+inline std::string to_lower_rm_space(std::string_view s) {
+    std::string ans;
+    ans.reserve(s.size());
+    for (char c : s) {
+        if (isspace(c)) {
+            continue;;
+        }
+        ans.push_back(tolower(c));
+    }
+    return ans;
+}
+
+/// Markers of the types, that can be listed in TYPES, and their spelling in
+/// options, see run_for_matching
+struct double_type_marker {
+    using type = double;
+
+    std::string name() const {
+        return "double";
+    }
+
+    bool matches(std::string_view s) const {
+        return to_lower_rm_space(s) == name();
+    }
+};
+
+struct float_type_marker {
+    using type = float;
+
+    std::string name() const {
+        return "float";
+    }
+
+    bool matches(std::string_view s) const {
+        return to_lower_rm_space(s) == name();
+    }
+};
+
+template<size_t N, size_t K>
+struct fixed_type_marker {
+    using type = Fixed<N, K>;
+
+    std::string name() const {
+        std::stringstream ss;
+        ss << "fixed(" << N << "," << K << ")";
+        return ss.str();
+    }
+
+    bool matches(std::string_view s) const {
+        return to_lower_rm_space(s) == name();
+    }  
+};
+
+template<size_t N, size_t K>
+struct fast_fixed_type_marker {
+    using type = FastFixed<N, K>;
+
+    std::string name() const {
+        std::stringstream ss;
+        ss << "fast_fixed(" << N << "," << K << ")";
+        return ss.str();
+    }
+
+    bool matches(std::string_view s) const {
+        return to_lower_rm_space(s) == name();
+    }  
+};
+
+template<size_t N, size_t K>
+struct packed_fixed_type_marker {
+    using type = PackedFixed<N, K>;
+
+    std::string name() const {
+        std::stringstream ss;
+        ss << "packed_fixed(" << N << "," << K << ")";
+        return ss.str();
+    }
+
+    bool matches(std::string_view s) const {
+        return to_lower_rm_space(s) == name();
+    }
+};
+
+#define FLOAT float_type_marker
+#define DOUBLE double_type_marker
+#define FIXED(N, K) fixed_type_marker<N, K>
+#define FAST_FIXED(N, K) fast_fixed_type_marker<N, K>
+#define PACKED_FIXED(N, K) packed_fixed_type_marker<N, K>